@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "sorter.h"
+
+//------------------------------------------------------------------------------
+// the front door: everything in the library allocates through these
+
+void * sorter_malloc(const SorterAllocator * allocator, size_t size) {
+    if(allocator == NULL) return malloc(size);
+    return allocator->allocate(allocator->context, size);
+}
+
+void * sorter_calloc(const SorterAllocator * allocator, size_t count, size_t size) {
+    if(allocator == NULL) return calloc(count, size);
+    if(size != 0 && count > SIZE_MAX / size) return NULL;
+
+    void * pointer = allocator->allocate(allocator->context, count * size);
+    if(pointer != NULL) memset(pointer, 0, count * size);
+    return pointer;
+}
+
+void * sorter_realloc(const SorterAllocator * allocator, void * pointer, size_t size) {
+    if(allocator == NULL) return realloc(pointer, size);
+    return allocator->reallocate(allocator->context, pointer, size);
+}
+
+void sorter_free(const SorterAllocator * allocator, void * pointer) {
+    if(pointer == NULL) return;
+    if(allocator == NULL) free(pointer);
+    else allocator->release(allocator->context, pointer);
+}
+
+//------------------------------------------------------------------------------
+// tracking allocator
+// every block gets a header in front holding its size, so frees and reallocs know what they give back
+// the header is max_align_t sized so the pointer handed out is still suitably aligned
+
+typedef union {
+    size_t size;
+    max_align_t align;
+} BlockHeader;
+
+static AllocationStage * current_stage(TrackingAllocator * tracker) {
+    return &tracker->stages[tracker->num_stages - 1];
+}
+
+// call with the lock held
+static void note_live(TrackingAllocator * tracker, size_t old_size, size_t new_size) {
+    tracker->live = tracker->live - old_size + new_size;
+    AllocationStage * stage = current_stage(tracker);
+    if(new_size > old_size) stage->bytes_allocated += new_size - old_size;
+    if(tracker->live > stage->peak_live) stage->peak_live = tracker->live;
+}
+
+static void * tracking_allocate(void * context, size_t size) {
+    TrackingAllocator * tracker = (TrackingAllocator *) context;
+    BlockHeader * header = malloc(sizeof(BlockHeader) + size);
+    if(header == NULL) return NULL;
+    header->size = size;
+
+    pthread_mutex_lock(&tracker->lock);
+    current_stage(tracker)->allocations++;
+    note_live(tracker, 0, size);
+    pthread_mutex_unlock(&tracker->lock);
+
+    return header + 1;
+}
+
+static void * tracking_reallocate(void * context, void * pointer, size_t size) {
+    if(pointer == NULL) return tracking_allocate(context, size);
+
+    TrackingAllocator * tracker = (TrackingAllocator *) context;
+    BlockHeader * header = (BlockHeader *) pointer - 1;
+    size_t old_size = header->size;
+
+    header = realloc(header, sizeof(BlockHeader) + size);
+    if(header == NULL) return NULL;
+    header->size = size;
+
+    pthread_mutex_lock(&tracker->lock);
+    current_stage(tracker)->reallocations++;
+    note_live(tracker, old_size, size);
+    pthread_mutex_unlock(&tracker->lock);
+
+    return header + 1;
+}
+
+static void tracking_release(void * context, void * pointer) {
+    TrackingAllocator * tracker = (TrackingAllocator *) context;
+    BlockHeader * header = (BlockHeader *) pointer - 1;
+
+    pthread_mutex_lock(&tracker->lock);
+    current_stage(tracker)->frees++;
+    note_live(tracker, header->size, 0);
+    pthread_mutex_unlock(&tracker->lock);
+
+    free(header);
+}
+
+void init_tracking_allocator(TrackingAllocator * tracker) {
+    memset(tracker, 0, sizeof(TrackingAllocator));
+    tracker->allocator.allocate = &tracking_allocate;
+    tracker->allocator.reallocate = &tracking_reallocate;
+    tracker->allocator.release = &tracking_release;
+    tracker->allocator.context = tracker;
+    pthread_mutex_init(&tracker->lock, NULL);
+
+    // anything allocated before the first begin_allocation_stage() still has somewhere to go
+    tracker->stages[0].name = "setup";
+    tracker->num_stages = 1;
+}
+
+void begin_allocation_stage(TrackingAllocator * tracker, const char * name) {
+    pthread_mutex_lock(&tracker->lock);
+    current_stage(tracker)->live_at_end = tracker->live;
+
+    // out of room, so the last stage soaks up the rest
+    if(tracker->num_stages < MAX_ALLOCATION_STAGES) {
+        AllocationStage * stage = &tracker->stages[tracker->num_stages++];
+        stage->name = name;
+        stage->peak_live = tracker->live;
+    }
+    pthread_mutex_unlock(&tracker->lock);
+}
+
+static void write_bytes(FILE * output_file, size_t bytes) {
+    if(bytes >= 1024 * 1024) fprintf(output_file, "%10.1f MiB", bytes / (1024.0 * 1024.0));
+    else if(bytes >= 1024) fprintf(output_file, "%10.1f KiB", bytes / 1024.0);
+    else fprintf(output_file, "%10zu B  ", bytes);
+}
+
+void write_allocation_report(TrackingAllocator * tracker, FILE * output_file) {
+    pthread_mutex_lock(&tracker->lock);
+    current_stage(tracker)->live_at_end = tracker->live;
+
+    size_t peak_live = 0;
+    fprintf(output_file, "%-12s %10s %10s %10s %14s %14s %14s\n", "STAGE", "ALLOCS", "REALLOCS", "FREES", "ALLOCATED", "PEAK LIVE", "LIVE AFTER");
+    for(unsigned int i = 0; i < tracker->num_stages; i++) {
+        const AllocationStage * stage = &tracker->stages[i];
+        if(stage->peak_live > peak_live) peak_live = stage->peak_live;
+        if(i == 0 && stage->allocations == 0 && stage->reallocations == 0) continue; // nothing before the first stage
+
+        fprintf(output_file, "%-12s %10llu %10llu %10llu ", stage->name, stage->allocations, stage->reallocations, stage->frees);
+        write_bytes(output_file, stage->bytes_allocated);
+        write_bytes(output_file, stage->peak_live);
+        write_bytes(output_file, stage->live_at_end);
+        fputc('\n', output_file);
+    }
+    fprintf(output_file, "peak live memory: ");
+    write_bytes(output_file, peak_live);
+    fputc('\n', output_file);
+
+    pthread_mutex_unlock(&tracker->lock);
+}
+
+void destroy_tracking_allocator(TrackingAllocator * tracker) {
+    pthread_mutex_destroy(&tracker->lock);
+}
@@ -0,0 +1,382 @@
+#define _POSIX_C_SOURCE 200809L // getline()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "sorter.h"
+
+//------------------------------------------------------------------------------
+// listing the catalogs
+
+static SorterError add_job(BatchSummary * summary, unsigned int * capacity, char * input_filename, char * output_filename) {
+    if(input_filename == NULL || output_filename == NULL) {
+        sorter_free(summary->allocator, input_filename);
+        sorter_free(summary->allocator, output_filename);
+        return SORTER_ERR_OUT_OF_MEMORY;
+    }
+
+    if(summary->num_jobs >= *capacity) {
+        unsigned int new_capacity = (*capacity == 0) ? 16 : *capacity * 2;
+        BatchJob * jobs = sorter_realloc(summary->allocator, summary->jobs, new_capacity * sizeof(BatchJob));
+        if(jobs == NULL) {
+            sorter_free(summary->allocator, input_filename);
+            sorter_free(summary->allocator, output_filename);
+            return SORTER_ERR_OUT_OF_MEMORY;
+        }
+        summary->jobs = jobs;
+        *capacity = new_capacity;
+    }
+
+    BatchJob * job = &summary->jobs[summary->num_jobs++];
+    memset(job, 0, sizeof(BatchJob));
+    job->input_filename = input_filename;
+    job->output_filename = output_filename;
+    return SORTER_OK;
+}
+
+// directory + "/" + name (+ extension), from allocator
+static char * join_path(const SorterAllocator * allocator, const char * directory, const char * name, size_t name_len, const char * extension) {
+    size_t len = strlen(directory) + 1 + name_len + strlen(extension) + 1;
+    char * path = sorter_malloc(allocator, len);
+    if(path != NULL) snprintf(path, len, "%s/%.*s%s", directory, (int) name_len, name, extension);
+    return path;
+}
+
+// strdup(), from allocator
+static char * copy_string(const SorterAllocator * allocator, const char * string) {
+    size_t len = strlen(string) + 1;
+    char * copy = sorter_malloc(allocator, len);
+    if(copy != NULL) memcpy(copy, string, len);
+    return copy;
+}
+
+static bool is_catalog_name(const char * name) {
+    size_t len = strlen(name);
+    if(name[0] == '.' || len < 5) return false;
+    return str_equal(name + len - 4, ".txt") || str_equal(name + len - 4, ".csv");
+}
+
+static int compare_names(const void * a, const void * b) {
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+// every .txt and .csv file in the directory, by name; "history.csv" is written to "<output_dir>/history.txt"
+static SorterError list_directory(const BatchOptions * options, BatchSummary * summary) {
+    if(options->output_dir == NULL) {
+        snprintf(summary->error_detail, sizeof(summary->error_detail), "a directory of catalogs needs an output directory");
+        return SORTER_ERR_USAGE;
+    }
+
+    DIR * directory = opendir(options->path);
+    if(directory == NULL) return SORTER_ERR_INPUT_FILE;
+
+    char ** names = NULL;
+    unsigned int num_names = 0;
+    unsigned int names_capacity = 0;
+    SorterError error = SORTER_OK;
+
+    struct dirent * entry;
+    while(error == SORTER_OK && (entry = readdir(directory)) != NULL) {
+        if(!is_catalog_name(entry->d_name)) continue;
+
+        if(num_names >= names_capacity) {
+            names_capacity = (names_capacity == 0) ? 16 : names_capacity * 2;
+            char ** bigger = sorter_realloc(summary->allocator, names, names_capacity * sizeof(char *));
+            if(bigger == NULL) {
+                error = SORTER_ERR_OUT_OF_MEMORY;
+                break;
+            }
+            names = bigger;
+        }
+        names[num_names] = copy_string(summary->allocator, entry->d_name);
+        if(names[num_names] == NULL) error = SORTER_ERR_OUT_OF_MEMORY;
+        else num_names++;
+    }
+    closedir(directory);
+
+    // readdir() order is whatever the filesystem likes
+    if(num_names > 0) qsort(names, num_names, sizeof(char *), &compare_names);
+
+    unsigned int capacity = 0;
+    for(unsigned int i = 0; i < num_names; i++) {
+        if(error == SORTER_OK) {
+            size_t stem_len = strlen(names[i]) - 4;
+            char * input_filename = join_path(summary->allocator, options->path, names[i], strlen(names[i]), "");
+            char * output_filename = join_path(summary->allocator, options->output_dir, names[i], stem_len, ".txt");
+            error = add_job(summary, &capacity, input_filename, output_filename);
+        }
+        sorter_free(summary->allocator, names[i]);
+    }
+    sorter_free(summary->allocator, names);
+
+    return error;
+}
+
+// one "input\toutput" per line; blank lines and lines starting with # are skipped
+static SorterError read_manifest(const BatchOptions * options, BatchSummary * summary) {
+    FILE * manifest = fopen(options->path, "r");
+    if(manifest == NULL) return SORTER_ERR_INPUT_FILE;
+
+    char * line = NULL;
+    size_t line_capacity = 0;
+    unsigned int line_number = 0;
+    unsigned int capacity = 0;
+    SorterError error = SORTER_OK;
+
+    while(error == SORTER_OK && getline(&line, &line_capacity, manifest) != -1) {
+        line_number++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if(line[0] == '\0' || line[0] == '#') continue;
+
+        char * tab = strchr(line, '\t');
+        if(tab == NULL || tab == line || tab[1] == '\0') {
+            snprintf(summary->error_detail, sizeof(summary->error_detail), "line %u of the manifest isn't \"input<TAB>output\"", line_number);
+            error = SORTER_ERR_USAGE;
+            break;
+        }
+        *tab = '\0';
+        const char * output = tab + 1;
+
+        char * output_filename = (options->output_dir != NULL && output[0] != '/') ? join_path(summary->allocator, options->output_dir, output, strlen(output), "") : copy_string(summary->allocator, output);
+        error = add_job(summary, &capacity, copy_string(summary->allocator, line), output_filename);
+    }
+
+    free(line); // getline()'s, not ours
+    fclose(manifest);
+    return error;
+}
+
+// "a.txt" and "a.csv" both become "<output_dir>/a.txt", and a manifest can name an output twice;
+// two workers writing one file would both say "ok", so only the first job gets it
+static void fail_duplicate_outputs(BatchSummary * summary) {
+    for(unsigned int j = 1; j < summary->num_jobs; j++) {
+        BatchJob * job = &summary->jobs[j];
+        for(unsigned int k = 0; k < j; k++) {
+            if(!str_equal(job->output_filename, summary->jobs[k].output_filename)) continue;
+
+            job->error = SORTER_ERR_OUTPUT_FILE;
+            snprintf(job->error_detail, sizeof(job->error_detail), "%.*s is already the output of %.*s", MAX_LINE_LENGTH - 64, job->output_filename, MAX_LINE_LENGTH - 64, summary->jobs[k].input_filename);
+            break;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// running one catalog
+
+static double seconds_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static bool same_file(const char * a, const char * b) {
+    struct stat stat_a, stat_b;
+    if(stat(a, &stat_a) != 0 || stat(b, &stat_b) != 0) return false;
+    return (stat_a.st_dev == stat_b.st_dev) && (stat_a.st_ino == stat_b.st_ino);
+}
+
+// the same pipeline as main(); the output file is only opened once everything before it worked
+static void run_job(const BatchOptions * options, BatchJob * job) {
+    double start = seconds_now();
+    Library library;
+    LibraryIndex index = { 0 };
+    Selection selection = { 0 };
+
+    if(same_file(job->input_filename, job->output_filename)) {
+        job->error = SORTER_ERR_OUTPUT_FILE;
+        snprintf(job->error_detail, sizeof(job->error_detail), "the output would overwrite the input");
+        return;
+    }
+
+    FILE * input_file = fopen(job->input_filename, "r");
+    if(input_file == NULL) {
+        job->error = SORTER_ERR_INPUT_FILE;
+        return;
+    }
+
+    unsigned int fields = shelf_order_fields(&options->order) | ((options->query != NULL) ? query_fields(options->query) : 0);
+    job->error = parse_library_fields(input_file, options->allocator, fields, &library);
+    if(job->error != SORTER_OK) {
+        memcpy(job->error_detail, library.error_detail, sizeof(job->error_detail));
+        return;
+    }
+    library_release_source(&library); // the order and query were all it needed
+    job->num_books = library.num_books;
+    double parsed = seconds_now();
+    job->parse_seconds = parsed - start;
+
+    job->error = sort_library(&library, &options->order);
+
+    if(job->error == SORTER_OK && options->add_collections != NULL && order_keeps_authors_together(&options->order)) {
+        SorterError error = options->add_collections(&library);
+        if(error == SORTER_ERR_TITLE_NOT_FOUND || error == SORTER_ERR_BAD_COLLECTION) {
+            // the shelf is still worth writing without that collection
+            job->warning = true;
+            if(library.error_detail[0] != '\0') memcpy(job->error_detail, library.error_detail, sizeof(job->error_detail));
+            else snprintf(job->error_detail, sizeof(job->error_detail), "%s", sorter_strerror(error));
+        }
+        else if(error == SORTER_OK && library.error_detail[0] != '\0') {
+            job->warning = true; // a title was close enough
+            memcpy(job->error_detail, library.error_detail, sizeof(job->error_detail));
+        }
+        else job->error = error;
+
+        if(job->error == SORTER_OK) apply_collections(&library);
+    }
+
+    const unsigned int * positions = NULL;
+    unsigned int num_positions = library.num_books;
+    if(job->error == SORTER_OK && options->query != NULL) {
+        job->error = build_index(&library, &index);
+        if(job->error == SORTER_OK) job->error = run_query(&library, &index, options->query, &selection);
+        positions = selection.positions;
+        num_positions = selection.num_positions;
+    }
+    double sorted = seconds_now();
+    job->sort_seconds = sorted - parsed;
+
+    if(job->error == SORTER_OK) {
+        FILE * output_file = fopen(job->output_filename, "w");
+        if(output_file == NULL) job->error = SORTER_ERR_OUTPUT_FILE;
+        else {
+            do_output_positions(&library, positions, num_positions, output_file, output_format_for(job->output_filename));
+            if(fclose(output_file) != 0) job->error = SORTER_ERR_OUTPUT_FILE; // e.g. the disk filled up
+            job->num_written = num_positions;
+        }
+        job->output_seconds = seconds_now() - sorted;
+    }
+
+    destroy_selection(&selection);
+    destroy_index(&index);
+    destroy_library(&library);
+}
+
+//------------------------------------------------------------------------------
+// the pool
+
+typedef struct {
+    const BatchOptions * options;
+    BatchSummary * summary;
+    unsigned int next_job;
+    pthread_mutex_t lock;
+} BatchQueue;
+
+static void * run_jobs(void * _queue) {
+    BatchQueue * queue = (BatchQueue *) _queue;
+
+    for(;;) {
+        pthread_mutex_lock(&queue->lock);
+        unsigned int j = queue->next_job++;
+        pthread_mutex_unlock(&queue->lock);
+
+        if(j >= queue->summary->num_jobs) return NULL;
+        if(queue->summary->jobs[j].error == SORTER_OK) run_job(queue->options, &queue->summary->jobs[j]); // not failed already
+    }
+}
+
+SorterError run_batch(const BatchOptions * options, BatchSummary * summary) {
+    memset(summary, 0, sizeof(BatchSummary));
+    summary->allocator = options->allocator;
+    double start = seconds_now();
+
+    struct stat path_stat;
+    if(stat(options->path, &path_stat) != 0) return SORTER_ERR_INPUT_FILE;
+
+    SorterError error = S_ISDIR(path_stat.st_mode) ? list_directory(options, summary) : read_manifest(options, summary);
+    if(error != SORTER_OK) {
+        destroy_batch_summary(summary);
+        return error;
+    }
+    fail_duplicate_outputs(summary);
+
+    unsigned int num_threads = options->num_threads;
+    if(num_threads == 0) {
+        long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = (num_cpus > 0) ? (unsigned int) num_cpus : 1;
+    }
+    if(num_threads > MAX_BATCH_THREADS) num_threads = MAX_BATCH_THREADS;
+    if(num_threads > summary->num_jobs) num_threads = summary->num_jobs;
+
+    BatchQueue queue = { .options = options, .summary = summary, .next_job = 0 };
+    pthread_mutex_init(&queue.lock, NULL);
+
+    // this thread works too; if a thread won't start, the others just take its share
+    pthread_t threads[MAX_BATCH_THREADS];
+    bool started[MAX_BATCH_THREADS] = { false };
+    for(unsigned int t = 1; t < num_threads; t++) {
+        if(pthread_create(&threads[t], NULL, &run_jobs, &queue) == 0) started[t] = true;
+    }
+    run_jobs(&queue);
+    for(unsigned int t = 1; t < num_threads; t++) {
+        if(started[t]) pthread_join(threads[t], NULL);
+    }
+
+    pthread_mutex_destroy(&queue.lock);
+
+    summary->num_threads = (num_threads > 0) ? num_threads : 1;
+    for(unsigned int j = 0; j < summary->num_jobs; j++) {
+        if(summary->jobs[j].error != SORTER_OK) summary->num_failed++;
+        else if(summary->jobs[j].warning) summary->num_warnings++;
+    }
+    summary->wall_seconds = seconds_now() - start;
+
+    return SORTER_OK;
+}
+
+//------------------------------------------------------------------------------
+
+static void write_seconds(FILE * output_file, double seconds, bool ran) {
+    if(!ran) fprintf(output_file, " %9s", "-");
+    else if(seconds < 1.0) fprintf(output_file, " %7.1fms", seconds * 1000.0);
+    else fprintf(output_file, " %8.2fs", seconds);
+}
+
+void write_batch_summary(const BatchSummary * summary, FILE * output_file) {
+    int longest_name_length = (int) strlen("CATALOG");
+    for(unsigned int j = 0; j < summary->num_jobs; j++) {
+        int len = (int) strlen(summary->jobs[j].input_filename);
+        if(len > longest_name_length) longest_name_length = len;
+    }
+
+    fprintf(output_file, "%-*s %8s %8s %9s %9s %9s  %s\n", longest_name_length, "CATALOG", "BOOKS", "WRITTEN", "PARSE", "SORT", "OUTPUT", "RESULT");
+
+    double work_seconds = 0.0;
+    for(unsigned int j = 0; j < summary->num_jobs; j++) {
+        const BatchJob * job = &summary->jobs[j];
+        bool parsed = (job->parse_seconds > 0.0);
+        bool sorted = (job->sort_seconds > 0.0);
+        bool written = (job->error == SORTER_OK);
+        work_seconds += job->parse_seconds + job->sort_seconds + job->output_seconds;
+
+        fprintf(output_file, "%-*s %8u %8u", longest_name_length, job->input_filename, job->num_books, job->num_written);
+        write_seconds(output_file, job->parse_seconds, parsed);
+        write_seconds(output_file, job->sort_seconds, sorted);
+        write_seconds(output_file, job->output_seconds, written);
+
+        if(job->error != SORTER_OK) fprintf(output_file, "  FAILED: %s\n", sorter_strerror(job->error));
+        else fprintf(output_file, "  %s -> %s\n", job->warning ? "WARNING" : "ok", job->output_filename);
+        if(job->error_detail[0] != '\0') fprintf(output_file, "    %s\n", job->error_detail);
+    }
+
+    fprintf(output_file, "%u catalogs: %u written (%u with warnings), %u failed; %.2fs on %u thread%s, %.2fs of work\n",
+        summary->num_jobs, summary->num_jobs - summary->num_failed, summary->num_warnings, summary->num_failed,
+        summary->wall_seconds, summary->num_threads, (summary->num_threads == 1) ? "" : "s", work_seconds);
+}
+
+void destroy_batch_summary(BatchSummary * summary) {
+    for(unsigned int j = 0; j < summary->num_jobs; j++) {
+        sorter_free(summary->allocator, summary->jobs[j].input_filename);
+        sorter_free(summary->allocator, summary->jobs[j].output_filename);
+    }
+    sorter_free(summary->allocator, summary->jobs);
+    summary->jobs = NULL;
+    summary->num_jobs = 0;
+}
@@ -1,24 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+
 #include "sorter.h"
 
 //------------------------------------------------------------------------------
 
+// the library itself never exits; this is where errors turn into exit codes
+static void die(const Library * library, SorterError error, int exit_code) {
+    if(error == SORTER_ERR_USAGE) printf(USAGE_MESSAGE);
+    else if(library != NULL && library->error_detail[0] != '\0') printf("ERROR: %s!\n %s!\n", sorter_strerror(error), library->error_detail);
+    else printf("ERROR: %s!\n", sorter_strerror(error));
+    exit(exit_code);
+}
+
+// the collections on my shelf; main(), --serve and --batch all add them once the library is sorted
+static SorterError add_shelf_collections(Library * library) {
+    return add_collection(library, 4, "Spring Snow", "Runaway Horses", "The Temple of Dawn", "The Decay of the Angel");
+}
+
+// --batch puts warnings in its summary; everything else prints them as it goes
+static SorterError add_my_collections(Library * library) {
+    SorterError error = add_shelf_collections(library);
+    if(error == SORTER_OK && library->error_detail[0] != '\0') fprintf(stderr, "WARNING: %s!\n", library->error_detail); // a title was close enough
+    return error;
+}
+
+static volatile sig_atomic_t stop_serving = 0;
+
+static void handle_stop_signal(int signal_number) {
+    (void) signal_number;
+    stop_serving = 1;
+}
+
+// selections are in shelf order, so a search result can be looked up in one
+static int compare_positions(const void * a, const void * b) {
+    unsigned int x = *(const unsigned int *) a;
+    unsigned int y = *(const unsigned int *) b;
+    return (x > y) - (x < y);
+}
+
 int main(int argv, char ** argc) {
-    struct parse_args_ret_t args = parse_args(argv, argc);
-    struct open_files_ret_t files = open_files(args);
-    
-    Library library = parse_library(files.input_file);
+    SorterArgs args;
+    SorterFiles files;
+    Library library;
+    SorterError error;
+
+    if((error = parse_args(argv, argc, &args)) != SORTER_OK) die(NULL, error, 1);
+
+    // check the queries and the order before doing any real work
+    ShelfOrder order = DEFAULT_SHELF_ORDER;
+    if(args.order != NULL && (error = parse_shelf_order(args.order, &order)) != SORTER_OK) {
+        printf("ERROR: %s!\n %s!\n", sorter_strerror(error), order.error_detail);
+        exit(1);
+    }
+
+    Query query = { 0 };
+    for(unsigned int i = 0; i < args.num_where; i++) {
+        if((error = parse_query(args.where[i], &query)) != SORTER_OK) {
+            printf("ERROR: %s!\n %s!\n", sorter_strerror(error), query.error_detail);
+            exit(1);
+        }
+    }
+
+    // --memory counts every allocation the library makes, stage by stage
+    TrackingAllocator tracker;
+    const SorterAllocator * allocator = NULL;
+    if(args.memory) {
+        init_tracking_allocator(&tracker);
+        allocator = &tracker.allocator;
+    }
+    #define STAGE(name) if(args.memory) begin_allocation_stage(&tracker, name)
+
+    // --serve loads the library itself, and again whenever the input changes
+    if(args.serve != NULL) {
+        ServeOptions options = { .input_filename = args.input_filename, .socket_path = args.serve, .order = order, .add_collections = add_my_collections, .stop = &stop_serving, .allocator = allocator };
+        signal(SIGINT, handle_stop_signal);
+        signal(SIGTERM, handle_stop_signal);
+        STAGE("serve");
+        if((error = serve_library(&options)) != SORTER_OK) die(NULL, error, (error == SORTER_ERR_INPUT_FILE) ? 1 : 3);
+        if(args.memory) {
+            write_allocation_report(&tracker, stderr);
+            destroy_tracking_allocator(&tracker);
+        }
+        return 0;
+    }
+
+    // --batch runs everything below once per catalog, on several threads; they all count towards one stage
+    if(args.batch) {
+        BatchOptions options = { .path = args.input_filename, .output_dir = args.output_filename, .order = order, .query = (args.num_where > 0) ? &query : NULL, .add_collections = add_shelf_collections, .allocator = allocator };
+        BatchSummary summary;
+        STAGE("batch");
+        if((error = run_batch(&options, &summary)) != SORTER_OK) {
+            if(summary.error_detail[0] == '\0') die(NULL, error, 1);
+            printf("ERROR: %s!\n %s!\n", sorter_strerror(error), summary.error_detail);
+            exit(1);
+        }
+        write_batch_summary(&summary, stdout);
+        unsigned int num_failed = summary.num_failed;
+        destroy_batch_summary(&summary);
+        if(args.memory) {
+            write_allocation_report(&tracker, stderr);
+            destroy_tracking_allocator(&tracker);
+        }
+        return (num_failed > 0) ? 2 : 0;
+    }
+
+    if((error = open_files(&args, &files)) != SORTER_OK) die(NULL, error, 1);
+
+    // only the columns something below looks at get read; title and author always are
+    STAGE("parse");
+    unsigned int fields = shelf_order_fields(&order) | query_fields(&query) | (args.report ? REPORT_FIELDS : 0);
+    if((error = parse_library_fields(files.input_file, allocator, fields, &library)) != SORTER_OK) die(&library, error, 2);
+    library_release_source(&library); // that's everything this run will look at
 
     //----------------------------
 
-    sort_by_author(&library);
-    add_collection(&library, 4, "Spring Snow", "Runaway Horses", "The Temple of Dawn", "The Decay of the Angel");
-    apply_collections(&library);
+    // a report only counts, so it doesn't care about shelf order
+    // a range only needs its own page in order; the collections go in first so it can apply them too
+    if(args.range) {
+        STAGE("collections");
+        if(order_keeps_authors_together(&order) && (error = add_my_collections(&library)) != SORTER_OK) die(&library, error, 67);
+        STAGE("sort");
+        if((error = sort_library_range(&library, &order, args.range_begin, args.range_end)) != SORTER_OK) die(&library, error, 3);
+    }
+    else if(!args.report) {
+        STAGE("sort");
+        if((error = sort_library(&library, &order)) != SORTER_OK) die(&library, error, 3);
+
+        // collections keep an author's books together, which only means anything if the order does too
+        if(order_keeps_authors_together(&order)) {
+            STAGE("collections");
+            if((error = add_my_collections(&library)) != SORTER_OK) die(&library, error, 67);
+            apply_collections(&library);
+        }
+    }
 
     //----------------------------
 
-    do_output(library, files.output_file, files.output_format);
+    // --where narrows things down to a selection; without it, everything is selected
+    LibraryIndex index = { 0 };
+    Selection selection = { 0 };
+    const unsigned int * positions = NULL;
+    unsigned int num_positions = library.num_books;
+
+    unsigned int * range_positions = NULL;
+    if(args.range) {
+        unsigned int range_end = (args.range_end < library.num_books) ? args.range_end : library.num_books;
+        num_positions = (args.range_begin < range_end) ? range_end - args.range_begin : 0;
+        range_positions = sorter_malloc(allocator, (num_positions + 1) * sizeof(unsigned int));
+        if(range_positions == NULL) die(&library, SORTER_ERR_OUT_OF_MEMORY, 3);
+        for(unsigned int i = 0; i < num_positions; i++) range_positions[i] = args.range_begin + i;
+        positions = range_positions;
+    }
+
+    if(args.num_where > 0) {
+        STAGE("query");
+        if((error = build_index(&library, &index)) != SORTER_OK) die(&library, error, 3);
+        if((error = run_query(&library, &index, &query, &selection)) != SORTER_OK) die(&library, error, 3);
+        positions = selection.positions;
+        num_positions = selection.num_positions;
+    }
+
+    // --search narrows it further, to the closest matches, best first
+    unsigned int search_positions[MAX_SEARCH_RESULTS];
+    if(args.search != NULL) {
+        const SearchIndex * search_index;
+        SearchResults results;
+        STAGE("search");
+        if((error = library_search_index(&library, &search_index)) != SORTER_OK) die(&library, error, 3);
+        if((error = search_library(&library, search_index, args.search, true, &results)) != SORTER_OK) die(&library, error, 3);
+
+        unsigned int num_found = 0;
+        for(unsigned int i = 0; i < results.num_matches; i++) {
+            if(positions == NULL || bsearch(&results.matches[i].position, positions, num_positions, sizeof(unsigned int), compare_positions) != NULL) {
+                search_positions[num_found++] = results.matches[i].position;
+            }
+        }
+        positions = search_positions;
+        num_positions = num_found;
+    }
+
+    STAGE("output");
+    if(args.report) {
+        Report report;
+        if((error = build_report(&library, positions, num_positions, &report)) != SORTER_OK) die(&library, error, 3);
+        write_report(&library, &report, files.output_file, files.output_format);
+        destroy_report(&report);
+    }
+    else if(args.site != NULL) {
+        SiteSummary site;
+        if((error = write_site(&library, &order, positions, num_positions, args.site, &site)) != SORTER_OK) {
+            if(site.error_detail[0] == '\0') die(&library, error, 1);
+            printf("ERROR: %s!\n %s!\n", sorter_strerror(error), site.error_detail);
+            exit(1);
+        }
+        printf("%s: %u pages, %u written, %u unchanged, %u removed\n", args.site, site.num_pages, site.num_written, site.num_unchanged, site.num_removed);
+    }
+    else do_output_positions(&library, positions, num_positions, files.output_file, files.output_format);
+
+    STAGE("cleanup");
+    destroy_selection(&selection);
+    destroy_index(&index);
+    sorter_free(allocator, range_positions);
+
+    if(files.output_file != NULL) fclose(files.output_file);
+    destroy_library(&library);
 
-    destroy_library(library);
+    if(args.memory) {
+        write_allocation_report(&tracker, stderr);
+        destroy_tracking_allocator(&tracker);
+    }
+    #undef STAGE
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,453 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "sorter.h"
+
+// bitmaps are arrays of these, one bit per shelf position
+#define WORD_BITS 64
+
+//------------------------------------------------------------------------------
+// parsing - "status=None && subject^=Philosophy && date>=2024 January"
+
+static bool is_space(char c) {
+    return (c == ' ') || (c == '\t') || (c == '\n') || (c == '\r');
+}
+
+static bool is_letter(char c) {
+    return ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z'));
+}
+
+static SorterError parse_predicate(const char * start, const char * end, Query * query) {
+    // longest operators first, so ">=" isn't read as ">" followed by "=value"
+    static const struct { const char * text; MatchOp op; } OPERATORS[] = {
+        { "^=", MATCH_PREFIX },
+        { "!=", MATCH_NOT_EQUAL },
+        { ">=", MATCH_GREATER_EQUAL },
+        { "<=", MATCH_LESS_EQUAL },
+        { "=", MATCH_EQUAL },
+        { ">", MATCH_GREATER },
+        { "<", MATCH_LESS },
+    };
+
+    while(start < end && is_space(*start)) start++;
+    while(end > start && is_space(*(end - 1))) end--;
+
+    if(query->num_predicates >= MAX_PREDICATES) {
+        snprintf(query->error_detail, sizeof(query->error_detail), "more than %d predicates", MAX_PREDICATES);
+        return SORTER_ERR_BAD_QUERY;
+    }
+
+    Predicate * predicate = &query->predicates[query->num_predicates];
+
+    const char * name_end = start;
+    while(name_end < end && is_letter(*name_end)) name_end++;
+    if(!parse_field_name(start, name_end - start, &predicate->field)) {
+        snprintf(query->error_detail, sizeof(query->error_detail), "\"%.*s\" is not a field", (int) (name_end - start), start);
+        return SORTER_ERR_BAD_QUERY;
+    }
+
+    const char * cursor = name_end;
+    while(cursor < end && is_space(*cursor)) cursor++;
+
+    bool found_operator = false;
+    for(size_t i = 0; i < sizeof(OPERATORS) / sizeof(OPERATORS[0]); i++) {
+        size_t len = strlen(OPERATORS[i].text);
+        if((size_t) (end - cursor) >= len && strncmp(cursor, OPERATORS[i].text, len) == 0) {
+            predicate->op = OPERATORS[i].op;
+            cursor += len;
+            found_operator = true;
+            break;
+        }
+    }
+    if(!found_operator) {
+        snprintf(query->error_detail, sizeof(query->error_detail), "expected =, !=, ^=, <, <=, > or >= after \"%s\"", FIELD_NAMES[predicate->field]);
+        return SORTER_ERR_BAD_QUERY;
+    }
+
+    while(cursor < end && is_space(*cursor)) cursor++;
+    size_t value_len = end - cursor;
+    if(value_len >= sizeof(predicate->value)) {
+        snprintf(query->error_detail, sizeof(query->error_detail), "value for \"%s\" is too long", FIELD_NAMES[predicate->field]);
+        return SORTER_ERR_BAD_QUERY;
+    }
+    memcpy(predicate->value, cursor, value_len);
+    predicate->value[value_len] = '\0';
+
+    if(predicate->field == DATE && parse_date(predicate->value) == 0) {
+        snprintf(query->error_detail, sizeof(query->error_detail), "\"%s\" is not a date like \"2024 December\" or \"2024\"", predicate->value);
+        return SORTER_ERR_BAD_QUERY;
+    }
+
+    query->num_predicates++;
+    return SORTER_OK;
+}
+
+SorterError parse_query(const char * expression, Query * query) {
+    const char * cursor = expression;
+
+    for(;;) {
+        const char * end = strstr(cursor, "&&");
+        if(end == NULL) end = cursor + strlen(cursor);
+
+        SorterError error = parse_predicate(cursor, end, query);
+        if(error != SORTER_OK) return error;
+
+        if(*end == '\0') break;
+        cursor = end + 2;
+    }
+
+    return SORTER_OK;
+}
+
+unsigned int query_fields(const Query * query) {
+    unsigned int fields = 0;
+    for(unsigned int p = 0; p < query->num_predicates; p++) fields |= FIELD_BIT(query->predicates[p].field);
+    return fields;
+}
+
+//------------------------------------------------------------------------------
+// index
+
+SorterError build_index(const Library * library, LibraryIndex * index) {
+    memset(index, 0, sizeof(LibraryIndex));
+    index->allocator = library->allocator;
+
+    unsigned int num_books = library->num_books;
+    index->num_books = num_books;
+    index->num_words = (num_books + WORD_BITS - 1) / WORD_BITS;
+
+    index->position_of = sorter_malloc(index->allocator, (num_books + 1) * sizeof(unsigned int));
+    if(index->position_of == NULL) return SORTER_ERR_OUT_OF_MEMORY;
+    for(unsigned int position = 0; position < num_books; position++) index->position_of[library->order[position]] = position;
+
+    for(int field = 0; field < EXPECTED_NUMBER_OF_FIELDS; field++) {
+        const StringColumn * column = &library->columns[field];
+        if(!column->is_dictionary || !column->materialized) continue; // a query on it couldn't run anyway
+
+        FieldIndex * field_index = &index->fields[field];
+        unsigned int num_values = column->num_values;
+        field_index->num_values = num_values;
+
+        field_index->value_starts = sorter_calloc(index->allocator, num_values + 1, sizeof(unsigned int));
+        field_index->positions = sorter_malloc(index->allocator, (num_books + 1) * sizeof(unsigned int));
+        field_index->dense = sorter_calloc(index->allocator, num_values + 1, sizeof(unsigned long long *));
+        unsigned int * fill = sorter_malloc(index->allocator, (num_values + 1) * sizeof(unsigned int));
+        if(field_index->value_starts == NULL || field_index->positions == NULL || field_index->dense == NULL || fill == NULL) {
+            sorter_free(index->allocator, fill);
+            destroy_index(index);
+            return SORTER_ERR_OUT_OF_MEMORY;
+        }
+
+        // count each value, then turn the counts into where each value's positions start
+        for(unsigned int row = 0; row < num_books; row++) field_index->value_starts[column->codes[row] + 1]++;
+        for(unsigned int v = 0; v < num_values; v++) field_index->value_starts[v + 1] += field_index->value_starts[v];
+        memcpy(fill, field_index->value_starts, num_values * sizeof(unsigned int));
+
+        // walking in shelf order leaves every value's positions sorted
+        for(unsigned int position = 0; position < num_books; position++) {
+            unsigned int v = column->codes[library->order[position]];
+            field_index->positions[fill[v]++] = position;
+        }
+        sorter_free(index->allocator, fill);
+
+        // a list costs 32 bits per book and a bitmap 1 bit per book in the library,
+        // so anything on more than 1/32 of the shelf is cheaper as a bitmap
+        // (there can't be more than 32 of those, which keeps the memory bounded)
+        for(unsigned int v = 0; v < num_values; v++) {
+            unsigned int count = field_index->value_starts[v + 1] - field_index->value_starts[v];
+            if(count == 0 || (unsigned long long) count * 32 < num_books) continue;
+
+            unsigned long long * bits = sorter_calloc(index->allocator, index->num_words, sizeof(unsigned long long));
+            if(bits == NULL) {
+                destroy_index(index);
+                return SORTER_ERR_OUT_OF_MEMORY;
+            }
+            for(unsigned int i = field_index->value_starts[v]; i < field_index->value_starts[v + 1]; i++) {
+                unsigned int position = field_index->positions[i];
+                bits[position / WORD_BITS] |= 1ULL << (position % WORD_BITS);
+            }
+            field_index->dense[v] = bits;
+        }
+    }
+
+    return SORTER_OK;
+}
+
+void destroy_index(LibraryIndex * index) {
+    for(int field = 0; field < EXPECTED_NUMBER_OF_FIELDS; field++) {
+        FieldIndex * field_index = &index->fields[field];
+        if(field_index->dense != NULL) {
+            for(unsigned int v = 0; v < field_index->num_values; v++) sorter_free(index->allocator, field_index->dense[v]);
+        }
+        sorter_free(index->allocator, field_index->dense);
+        sorter_free(index->allocator, field_index->value_starts);
+        sorter_free(index->allocator, field_index->positions);
+    }
+    sorter_free(index->allocator, index->position_of);
+
+    memset(index, 0, sizeof(LibraryIndex));
+}
+
+void destroy_selection(Selection * selection) {
+    sorter_free(selection->allocator, selection->positions);
+    memset(selection, 0, sizeof(Selection));
+}
+
+//------------------------------------------------------------------------------
+// evaluation
+
+// the words sanitize_title() drops from the front of a value
+static const char * const ARTICLES[] = { "the ", "an ", "on ", "a " };
+
+// does query start with one of them?
+// those change what a value collates as, so binary searching on them isn't safe
+static bool starts_with_article(const char * value) {
+    for(size_t i = 0; i < sizeof(ARTICLES) / sizeof(ARTICLES[0]); i++) {
+        size_t c = 0;
+        while(ARTICLES[i][c] != '\0') {
+            char letter = value[c];
+            if((letter >= 'A') && (letter <= 'Z')) letter += 'a' - 'A';
+            if(letter != ARTICLES[i][c]) break;
+            c++;
+        }
+        if(ARTICLES[i][c] == '\0') return true;
+    }
+    return false;
+}
+
+// is a prefix query the start of one of them, e.g. "The" or "A"?
+// then "The Hobbit" matches it, but collates as "hobbit", nowhere near the run for "the"
+static bool could_start_article(const char * prefix) {
+    for(size_t i = 0; i < sizeof(ARTICLES) / sizeof(ARTICLES[0]); i++) {
+        size_t c = 0;
+        while(prefix[c] != '\0') {
+            char letter = prefix[c];
+            if((letter >= 'A') && (letter <= 'Z')) letter += 'a' - 'A';
+            if(letter != ARTICLES[i][c]) break;
+            c++;
+        }
+        if(prefix[c] == '\0') return true;
+    }
+    return false;
+}
+
+static bool starts_with_nocase(const char * value, const char * prefix) {
+    for(; *prefix != '\0'; value++, prefix++) {
+        char a = *value;
+        char b = *prefix;
+        if((a >= 'A') && (a <= 'Z')) a += 'a' - 'A';
+        if((b >= 'A') && (b <= 'Z')) b += 'a' - 'A';
+        if(a != b) return false;
+    }
+    return true;
+}
+
+// compares value's collation form with an already sanitized query
+// prefix_len limits it to that many characters; 0 compares the whole thing
+static int compare_sanitized(const char * value, const char * sanitized_query, size_t prefix_len) {
+    char sanitized[MAX_LINE_LENGTH];
+    sanitize_title(value, sanitized, sizeof(sanitized));
+    if(prefix_len > 0) return strncmp(sanitized, sanitized_query, prefix_len);
+    return strcmp(sanitized, sanitized_query);
+}
+
+// first dictionary value that isn't before the query (or, with upper, that's after it)
+static unsigned int collation_bound(const StringColumn * column, const char * sanitized_query, size_t prefix_len, bool upper) {
+    unsigned int lo = 0;
+    unsigned int hi = column->num_values;
+    while(lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        int cmp = compare_sanitized(column->blob + column->offsets[mid], sanitized_query, prefix_len);
+        if(cmp < 0 || (upper && cmp == 0)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// same as above, but the DATE dictionary is in chronological order
+static unsigned int date_bound(const StringColumn * column, int date, bool upper) {
+    unsigned int lo = 0;
+    unsigned int hi = column->num_values;
+    while(lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        int value = parse_date(column->blob + column->offsets[mid]);
+        if(value < date || (upper && value == date)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static void add_value(const FieldIndex * field_index, unsigned int v, unsigned long long * bits, unsigned int num_words) {
+    if(field_index->dense[v] != NULL) {
+        const unsigned long long * dense = field_index->dense[v];
+        for(unsigned int w = 0; w < num_words; w++) bits[w] |= dense[w];
+        return;
+    }
+
+    for(unsigned int i = field_index->value_starts[v]; i < field_index->value_starts[v + 1]; i++) {
+        unsigned int position = field_index->positions[i];
+        bits[position / WORD_BITS] |= 1ULL << (position % WORD_BITS);
+    }
+}
+
+// dictionary fields: narrow the predicate down to a run of codes, then OR in those codes' positions
+static void match_dictionary(const Library * library, const LibraryIndex * index, const Predicate * predicate, unsigned long long * bits) {
+    const StringColumn * column = &library->columns[predicate->field];
+    const FieldIndex * field_index = &index->fields[predicate->field];
+    unsigned int num_values = column->num_values;
+    unsigned int lo = 0;
+    unsigned int hi = num_values;
+    bool check_each = false; // whether codes in [lo, hi) still need comparing one by one
+
+    if(predicate->field == DATE) {
+        // "2024" means all of 2024
+        int first = parse_date(predicate->value);
+        int last = (first % 100 == 0) ? first + 99 : first;
+
+        // books with no date (or one that doesn't parse) sort first as 0, and match no date comparison
+        unsigned int dated = date_bound(column, 1, false);
+
+        switch(predicate->op) {
+            case MATCH_EQUAL: case MATCH_NOT_EQUAL: case MATCH_PREFIX:
+                lo = date_bound(column, first, false);
+                hi = date_bound(column, last, true);
+                break;
+            case MATCH_LESS: hi = date_bound(column, first, false); break;
+            case MATCH_LESS_EQUAL: hi = date_bound(column, last, true); break;
+            case MATCH_GREATER: lo = date_bound(column, last, true); break;
+            case MATCH_GREATER_EQUAL: lo = date_bound(column, first, false); break;
+        }
+        if(lo < dated) lo = dated;
+
+        // != is applied by clearing what matches here, so the undated ones go in too
+        if(predicate->op == MATCH_NOT_EQUAL) {
+            for(unsigned int v = 0; v < dated; v++) add_value(field_index, v, bits, index->num_words);
+        }
+    } else {
+        char sanitized_query[MAX_LINE_LENGTH];
+        sanitize_title(predicate->value, sanitized_query, sizeof(sanitized_query));
+        size_t sanitized_len = strlen(sanitized_query);
+
+        switch(predicate->op) {
+            case MATCH_EQUAL: case MATCH_NOT_EQUAL: case MATCH_PREFIX: {
+                // values that match ignoring case also collate the same, so they're all in one run
+                check_each = true;
+                if(starts_with_article(predicate->value) || sanitized_len == 0) break; // no safe run, check everything
+                if(predicate->op == MATCH_PREFIX && could_start_article(predicate->value)) break;
+                // numbers are length-prefixed, so "Volume 1" isn't a collation prefix of "Volume 10"
+                if(predicate->op == MATCH_PREFIX && strpbrk(predicate->value, "0123456789") != NULL) break;
+                size_t prefix_len = (predicate->op == MATCH_PREFIX) ? sanitized_len : 0;
+                lo = collation_bound(column, sanitized_query, prefix_len, false);
+                hi = collation_bound(column, sanitized_query, prefix_len, true);
+                break;
+            }
+            case MATCH_LESS: hi = collation_bound(column, sanitized_query, 0, false); break;
+            case MATCH_LESS_EQUAL: hi = collation_bound(column, sanitized_query, 0, true); break;
+            case MATCH_GREATER: lo = collation_bound(column, sanitized_query, 0, true); break;
+            case MATCH_GREATER_EQUAL: lo = collation_bound(column, sanitized_query, 0, false); break;
+        }
+    }
+
+    for(unsigned int v = lo; v < hi; v++) {
+        if(check_each) {
+            const char * value = column->blob + column->offsets[v];
+            bool matches = (predicate->op == MATCH_PREFIX) ? starts_with_nocase(value, predicate->value) : str_equal_nocase(value, predicate->value);
+            if(!matches) continue;
+        }
+        add_value(field_index, v, bits, index->num_words);
+    }
+}
+
+// plain fields have no index, so walk the column in row order (which is memory order)
+static void match_plain(const Library * library, const LibraryIndex * index, const Predicate * predicate, unsigned long long * bits) {
+    const StringColumn * column = &library->columns[predicate->field];
+    size_t value_len = strlen(predicate->value);
+
+    char sanitized_query[MAX_LINE_LENGTH];
+    sanitize_title(predicate->value, sanitized_query, sizeof(sanitized_query));
+
+    for(unsigned int row = 0; row < library->num_books; row++) {
+        const char * value = column->blob + column->offsets[row];
+        bool matches = false;
+
+        switch(predicate->op) {
+            case MATCH_EQUAL: case MATCH_NOT_EQUAL:
+                matches = (column->lengths[row] == value_len) && str_equal_nocase(value, predicate->value);
+                break;
+            case MATCH_PREFIX: matches = (column->lengths[row] >= value_len) && starts_with_nocase(value, predicate->value); break;
+            case MATCH_LESS: matches = compare_sanitized(value, sanitized_query, 0) < 0; break;
+            case MATCH_LESS_EQUAL: matches = compare_sanitized(value, sanitized_query, 0) <= 0; break;
+            case MATCH_GREATER: matches = compare_sanitized(value, sanitized_query, 0) > 0; break;
+            case MATCH_GREATER_EQUAL: matches = compare_sanitized(value, sanitized_query, 0) >= 0; break;
+        }
+
+        if(matches) {
+            unsigned int position = index->position_of[row];
+            bits[position / WORD_BITS] |= 1ULL << (position % WORD_BITS);
+        }
+    }
+}
+
+SorterError run_query(const Library * library, const LibraryIndex * index, const Query * query, Selection * selection) {
+    memset(selection, 0, sizeof(Selection));
+    selection->allocator = library->allocator;
+
+    // the library has to have read every field the query looks at
+    for(unsigned int p = 0; p < query->num_predicates; p++) {
+        if(!library->columns[query->predicates[p].field].materialized) return SORTER_ERR_BAD_QUERY;
+    }
+
+    unsigned int num_words = index->num_words;
+    unsigned long long * result = sorter_malloc(library->allocator, (num_words + 1) * sizeof(unsigned long long));
+    unsigned long long * scratch = sorter_malloc(library->allocator, (num_words + 1) * sizeof(unsigned long long));
+    if(result == NULL || scratch == NULL) {
+        sorter_free(library->allocator, result);
+        sorter_free(library->allocator, scratch);
+        return SORTER_ERR_OUT_OF_MEMORY;
+    }
+
+    // start with everything, then AND each predicate in
+    // the last word only has num_books % 64 real positions, so keep the rest of it clear
+    unsigned long long last_word_mask = (index->num_books % WORD_BITS == 0) ? ~0ULL : (1ULL << (index->num_books % WORD_BITS)) - 1;
+    memset(result, 0xff, num_words * sizeof(unsigned long long));
+    if(num_words > 0) result[num_words - 1] &= last_word_mask;
+
+    for(unsigned int p = 0; p < query->num_predicates; p++) {
+        const Predicate * predicate = &query->predicates[p];
+
+        memset(scratch, 0, num_words * sizeof(unsigned long long));
+        if(library->columns[predicate->field].is_dictionary) match_dictionary(library, index, predicate, scratch);
+        else match_plain(library, index, predicate, scratch);
+
+        if(predicate->op == MATCH_NOT_EQUAL) {
+            for(unsigned int w = 0; w < num_words; w++) result[w] &= ~scratch[w];
+        } else {
+            for(unsigned int w = 0; w < num_words; w++) result[w] &= scratch[w];
+        }
+    }
+
+    unsigned int count = 0;
+    for(unsigned int w = 0; w < num_words; w++) count += __builtin_popcountll(result[w]);
+
+    selection->positions = sorter_malloc(library->allocator, (count + 1) * sizeof(unsigned int));
+    if(selection->positions == NULL) {
+        sorter_free(library->allocator, result);
+        sorter_free(library->allocator, scratch);
+        return SORTER_ERR_OUT_OF_MEMORY;
+    }
+
+    // set bits come out lowest first, which is shelf order
+    for(unsigned int w = 0; w < num_words; w++) {
+        unsigned long long word = result[w];
+        while(word != 0) {
+            selection->positions[selection->num_positions++] = w * WORD_BITS + __builtin_ctzll(word);
+            word &= word - 1;
+        }
+    }
+
+    sorter_free(library->allocator, result);
+    sorter_free(library->allocator, scratch);
+    return SORTER_OK;
+}
@@ -0,0 +1,314 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "sorter.h"
+
+// below this many books a thread costs more than it saves
+#define REPORT_CHUNK_SIZE 65536
+#define MAX_REPORT_THREADS 16
+
+// first match wins; viewer.c's colorize_subjects() colors by these too, one color per entry
+const char * const SUBJECT_CATEGORIES[NUM_SUBJECT_CATEGORIES] = {
+    "History",
+    "Biography",
+    "Sociology",
+    "Psychology",
+    "Score",
+    "Technical",
+    "Literature",
+    "Criticism",
+    "Religion",
+    "Textbook; Religion",
+    "Religious Primary",
+    "Philosophy",
+};
+
+int subject_category(const char * subject) {
+    for(int i = 0; i < NUM_SUBJECT_CATEGORIES; i++) {
+        if(strncmp(SUBJECT_CATEGORIES[i], subject, strlen(SUBJECT_CATEGORIES[i])) == 0) return i;
+    }
+    return -1;
+}
+
+//------------------------------------------------------------------------------
+// counting - an open addressing table from int keys to counts
+// a count of 0 marks an empty slot, since anything that's in the table has been counted at least once
+
+typedef struct {
+    int * keys;
+    unsigned int * counts;
+    unsigned int capacity;  // always a power of two
+    unsigned int size;
+    const SorterAllocator * allocator;
+} CountTable;
+
+static unsigned int hash_int(int key) {
+    unsigned int x = (unsigned int) key;
+    x ^= x >> 16;
+    x *= 0x45d9f3bu;
+    x ^= x >> 16;
+    return x;
+}
+
+static SorterError count_add(CountTable * table, int key, unsigned int amount) {
+    if((table->size + 1) * 2 > table->capacity) {
+        unsigned int capacity = (table->capacity == 0) ? 16 : table->capacity * 2;
+        int * keys = sorter_malloc(table->allocator, capacity * sizeof(int));
+        unsigned int * counts = sorter_calloc(table->allocator, capacity, sizeof(unsigned int));
+        if(keys == NULL || counts == NULL) {
+            sorter_free(table->allocator, keys);
+            sorter_free(table->allocator, counts);
+            return SORTER_ERR_OUT_OF_MEMORY;
+        }
+
+        for(unsigned int i = 0; i < table->capacity; i++) {
+            if(table->counts[i] == 0) continue;
+            unsigned int slot = hash_int(table->keys[i]) & (capacity - 1);
+            while(counts[slot] != 0) slot = (slot + 1) & (capacity - 1);
+            keys[slot] = table->keys[i];
+            counts[slot] = table->counts[i];
+        }
+
+        sorter_free(table->allocator, table->keys);
+        sorter_free(table->allocator, table->counts);
+        table->keys = keys;
+        table->counts = counts;
+        table->capacity = capacity;
+    }
+
+    unsigned int slot = hash_int(key) & (table->capacity - 1);
+    while(table->counts[slot] != 0 && table->keys[slot] != key) slot = (slot + 1) & (table->capacity - 1);
+
+    if(table->counts[slot] == 0) {
+        table->keys[slot] = key;
+        table->size++;
+    }
+    table->counts[slot] += amount;
+
+    return SORTER_OK;
+}
+
+static void count_destroy(CountTable * table) {
+    sorter_free(table->allocator, table->keys);
+    sorter_free(table->allocator, table->counts);
+    memset(table, 0, sizeof(CountTable));
+}
+
+//------------------------------------------------------------------------------
+// aggregation
+
+typedef struct {
+    const Library * library;
+    const unsigned int * positions;     // NULL means rows begin..end directly
+    const int * category_of_subject;    // by SUBJECT code
+    unsigned int begin;
+    unsigned int end;
+
+    CountTable subjects;
+    CountTable statuses;
+    CountTable months;
+    SorterError error;
+} ReportChunk;
+
+static void * count_chunk(void * _chunk) {
+    ReportChunk * chunk = (ReportChunk *) _chunk;
+    const Library * library = chunk->library;
+    const unsigned int * subject_codes = library->columns[SUBJECT].codes;
+    const unsigned int * status_codes = library->columns[STATUS].codes;
+
+    for(unsigned int i = chunk->begin; i < chunk->end; i++) {
+        // row order is memory order, so only go through order[] when we have to
+        unsigned int row = (chunk->positions == NULL) ? i : library->order[chunk->positions[i]];
+
+        SorterError error = count_add(&chunk->subjects, chunk->category_of_subject[subject_codes[row]], 1);
+        if(error == SORTER_OK) error = count_add(&chunk->statuses, (int) status_codes[row], 1);
+        if(error == SORTER_OK) error = count_add(&chunk->months, library->acquired[row], 1);
+        if(error != SORTER_OK) {
+            chunk->error = error;
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static int compare_months(const void * _a, const void * _b) {
+    const MonthCount * a = (const MonthCount *) _a;
+    const MonthCount * b = (const MonthCount *) _b;
+    return (a->month > b->month) - (a->month < b->month);
+}
+
+SorterError build_report(const Library * library, const unsigned int * positions, unsigned int num_positions, Report * report) {
+    memset(report, 0, sizeof(Report));
+    report->num_books = num_positions;
+    report->allocator = library->allocator;
+
+    const StringColumn * subjects = &library->columns[SUBJECT];
+    const StringColumn * statuses = &library->columns[STATUS];
+
+    // categorize each distinct subject once, rather than once per book
+    int * category_of_subject = sorter_malloc(library->allocator, (subjects->num_values + 1) * sizeof(int));
+    if(category_of_subject == NULL) return SORTER_ERR_OUT_OF_MEMORY;
+    for(unsigned int v = 0; v < subjects->num_values; v++) {
+        int category = subject_category(subjects->blob + subjects->offsets[v]);
+        category_of_subject[v] = (category < 0) ? NUM_SUBJECT_CATEGORIES : category;
+    }
+
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int num_chunks = num_positions / REPORT_CHUNK_SIZE + 1;
+    if(num_cpus > 0 && num_chunks > (unsigned int) num_cpus) num_chunks = (unsigned int) num_cpus;
+    if(num_chunks > MAX_REPORT_THREADS) num_chunks = MAX_REPORT_THREADS;
+
+    ReportChunk chunks[MAX_REPORT_THREADS];
+    pthread_t threads[MAX_REPORT_THREADS];
+    bool started[MAX_REPORT_THREADS] = { false };
+    memset(chunks, 0, sizeof(chunks));
+
+    for(unsigned int c = 0; c < num_chunks; c++) {
+        chunks[c].library = library;
+        chunks[c].positions = positions;
+        chunks[c].category_of_subject = category_of_subject;
+        chunks[c].subjects.allocator = chunks[c].statuses.allocator = chunks[c].months.allocator = library->allocator;
+        chunks[c].begin = (unsigned int) ((unsigned long long) num_positions * c / num_chunks);
+        chunks[c].end = (unsigned int) ((unsigned long long) num_positions * (c + 1) / num_chunks);
+
+        // the first chunk runs on this thread; if a thread won't start, its chunk does too
+        if(c > 0 && pthread_create(&threads[c], NULL, &count_chunk, &chunks[c]) == 0) started[c] = true;
+    }
+    count_chunk(&chunks[0]);
+    for(unsigned int c = 1; c < num_chunks; c++) {
+        if(started[c]) pthread_join(threads[c], NULL);
+        else count_chunk(&chunks[c]);
+    }
+
+    // fold every chunk into the first
+    SorterError error = chunks[0].error;
+    for(unsigned int c = 1; c < num_chunks && error == SORTER_OK; c++) {
+        error = chunks[c].error;
+        CountTable * tables[3] = { &chunks[c].subjects, &chunks[c].statuses, &chunks[c].months };
+        CountTable * totals[3] = { &chunks[0].subjects, &chunks[0].statuses, &chunks[0].months };
+        for(int t = 0; t < 3 && error == SORTER_OK; t++) {
+            for(unsigned int i = 0; i < tables[t]->capacity && error == SORTER_OK; i++) {
+                if(tables[t]->counts[i] != 0) error = count_add(totals[t], tables[t]->keys[i], tables[t]->counts[i]);
+            }
+        }
+    }
+
+    if(error == SORTER_OK) {
+        report->num_statuses = statuses->num_values;
+        report->status_counts = sorter_calloc(report->allocator, statuses->num_values + 1, sizeof(unsigned int));
+        report->months = sorter_malloc(report->allocator, (chunks[0].months.size + 1) * sizeof(MonthCount));
+        if(report->status_counts == NULL || report->months == NULL) error = SORTER_ERR_OUT_OF_MEMORY;
+    }
+
+    if(error == SORTER_OK) {
+        const CountTable * totals = &chunks[0].subjects;
+        for(unsigned int i = 0; i < totals->capacity; i++) {
+            if(totals->counts[i] != 0) report->subject_counts[totals->keys[i]] = totals->counts[i];
+        }
+
+        totals = &chunks[0].statuses;
+        for(unsigned int i = 0; i < totals->capacity; i++) {
+            if(totals->counts[i] != 0) report->status_counts[totals->keys[i]] = totals->counts[i];
+        }
+
+        totals = &chunks[0].months;
+        for(unsigned int i = 0; i < totals->capacity; i++) {
+            if(totals->counts[i] != 0) report->months[report->num_months++] = (MonthCount) { totals->keys[i], totals->counts[i] };
+        }
+        qsort(report->months, report->num_months, sizeof(MonthCount), &compare_months);
+    }
+
+    for(unsigned int c = 0; c < num_chunks; c++) {
+        count_destroy(&chunks[c].subjects);
+        count_destroy(&chunks[c].statuses);
+        count_destroy(&chunks[c].months);
+    }
+    sorter_free(library->allocator, category_of_subject);
+
+    if(error != SORTER_OK) destroy_report(report);
+    return error;
+}
+
+void destroy_report(Report * report) {
+    sorter_free(report->allocator, report->status_counts);
+    sorter_free(report->allocator, report->months);
+    memset(report, 0, sizeof(Report));
+}
+
+//------------------------------------------------------------------------------
+// output
+
+void write_report(const Library * library, const Report * report, FILE * output_file, OutputFormat output_format) {
+    static const char * const MONTH_NAMES[13] = { "", "January", "February", "March", "April", "May", "June", "July", "August", "September", "October", "November", "December" };
+
+    const char * txt_section_str = "%s\n";
+    const char * txt_format_str = "  %-*s %7u\n";
+
+    const char * html_preamble = "<style>\n\tbody {\n\t\tcolor: white;\n\t\tbackground-color: #222;\n\t}\n</style>\n\n";
+    const char * html_section_str = "<table style=\"width: 100%%;\">\n\t<tr>\n\t\t<th>%s</th>\n\t\t<th>BOOKS</th>\n\t</tr>\n";
+    const char * html_format_str = "\t<tr>\n\t\t<td>%s</td>\n\t\t<td>%u</td>\n\t</tr>\n";
+    const char * html_section_end = "</table>\n\n";
+
+    if(output_file == NULL) output_file = stdout; // OUTPUT_STDOUT
+    bool html = (output_format == OUTPUT_HTML) || (output_format == OUTPUT_WEBSITE);
+
+    if(output_format == OUTPUT_HTML) fputs(html_preamble, output_file);
+
+    // the labels are short, so one width for every table keeps the text columns lined up
+    const int label_width = 24;
+    char label[MAX_LINE_LENGTH];
+
+    #define SECTION(title) do { \
+        if(html) fprintf(output_file, html_section_str, title); \
+        else fprintf(output_file, txt_section_str, title); \
+    } while(0)
+
+    #define ROW(name, count) do { \
+        if(html) fprintf(output_file, html_format_str, name, count); \
+        else fprintf(output_file, txt_format_str, label_width, name, count); \
+    } while(0)
+
+    #define SECTION_END() do { \
+        if(html) fputs(html_section_end, output_file); \
+        else fputs("\n", output_file); \
+    } while(0)
+
+    SECTION("SUBJECT");
+    for(int i = 0; i < NUM_SUBJECT_CATEGORIES; i++) {
+        if(report->subject_counts[i] != 0) ROW(SUBJECT_CATEGORIES[i], report->subject_counts[i]);
+    }
+    if(report->subject_counts[NUM_SUBJECT_CATEGORIES] != 0) ROW("Other", report->subject_counts[NUM_SUBJECT_CATEGORIES]);
+    SECTION_END();
+
+    SECTION("STATUS");
+    const StringColumn * statuses = &library->columns[STATUS];
+    for(unsigned int v = 0; v < report->num_statuses; v++) {
+        if(report->status_counts[v] == 0) continue;
+        const char * status = statuses->blob + statuses->offsets[v];
+        ROW((status[0] != '\0') ? status : "(blank)", report->status_counts[v]);
+    }
+    SECTION_END();
+
+    SECTION("ACQUIRED");
+    for(unsigned int i = 0; i < report->num_months; i++) {
+        int month = report->months[i].month;
+        if(month == 0) snprintf(label, sizeof(label), "Unknown");
+        else if(month % 100 == 0) snprintf(label, sizeof(label), "%d", month / 100);
+        else snprintf(label, sizeof(label), "%d %s", month / 100, MONTH_NAMES[month % 100]);
+        ROW(label, report->months[i].count);
+    }
+    SECTION_END();
+
+    SECTION("TOTAL");
+    ROW("Books", report->num_books);
+    SECTION_END();
+
+    #undef SECTION
+    #undef ROW
+    #undef SECTION_END
+}
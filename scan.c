@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "sorter.h"
+
+// the scanner looks at the input this many bytes at a time, one bit per byte
+#define BLOCK_SIZE 64
+
+//------------------------------------------------------------------------------
+// structural index
+// for each block: a bitmask of where the quotes are, where the delimiters are and where the newlines are
+// quotes pair up, so a running xor over the quote bits gives "inside quotes" for every byte, and any
+// delimiter or newline outside of quotes is structural: it ends a field (or a field and a record)
+
+typedef struct {
+    unsigned long long quotes;
+    unsigned long long delimiters;
+    unsigned long long newlines;
+} BlockMasks;
+
+#ifdef __SSE2__
+
+static unsigned long long match_block(const __m128i * chunks, char c) {
+    __m128i needle = _mm_set1_epi8(c);
+    unsigned long long mask = 0;
+    for(int i = 0; i < BLOCK_SIZE / 16; i++) {
+        unsigned long long bits = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(chunks[i], needle));
+        mask |= bits << (16 * i);
+    }
+    return mask;
+}
+
+static BlockMasks scan_block(const char * block, char delimiter) {
+    __m128i chunks[BLOCK_SIZE / 16];
+    for(int i = 0; i < BLOCK_SIZE / 16; i++) chunks[i] = _mm_loadu_si128((const __m128i *) (block + 16 * i));
+
+    BlockMasks masks;
+    masks.quotes = match_block(chunks, '"');
+    masks.delimiters = match_block(chunks, delimiter);
+    masks.newlines = match_block(chunks, '\n');
+    return masks;
+}
+
+#else
+
+// same thing a byte at a time, for anything without SSE2
+static BlockMasks scan_block(const char * block, char delimiter) {
+    BlockMasks masks = { 0, 0, 0 };
+    for(int i = 0; i < BLOCK_SIZE; i++) {
+        unsigned long long bit = 1ULL << i;
+        if(block[i] == '"') masks.quotes |= bit;
+        else if(block[i] == delimiter) masks.delimiters |= bit;
+        else if(block[i] == '\n') masks.newlines |= bit;
+    }
+    return masks;
+}
+
+#endif
+
+// bit i of the result is the xor of bits 0..i; i.e. 1 from an opening quote up to (not including) its closing quote
+static unsigned long long prefix_xor(unsigned long long bits) {
+    bits ^= bits << 1;
+    bits ^= bits << 2;
+    bits ^= bits << 4;
+    bits ^= bits << 8;
+    bits ^= bits << 16;
+    bits ^= bits << 32;
+    return bits;
+}
+
+// newlines up to and including bit
+static unsigned int newlines_through(unsigned long long newlines, unsigned int bit) {
+    unsigned long long below = (bit == BLOCK_SIZE - 1) ? ~0ULL : (1ULL << (bit + 1)) - 1;
+    return (unsigned int) __builtin_popcountll(newlines & below);
+}
+
+//------------------------------------------------------------------------------
+// fields
+
+// copies a raw field out, without its quotes; "" inside quotes is one quote,
+// and a line break inside quotes becomes a space so every value still fits on one line of output
+// values longer than MAX_LINE_LENGTH - 1 bytes are cut short, at a character boundary
+// ends_record: the field is the last of its line, so a '\r' at the end is half of a CRLF
+static unsigned int unquote_field(const char * raw, size_t len, bool ends_record, char * output_buf) {
+    if(ends_record && len > 0 && raw[len - 1] == '\r') len--; // CRLF line endings
+
+    size_t out = 0;
+    bool truncated = false;
+    unsigned char dropped = 0;
+
+    #define EMIT(c) do { \
+        if(out < MAX_LINE_LENGTH - 1) output_buf[out++] = (c); \
+        else if(!truncated) { truncated = true; dropped = (unsigned char) (c); } \
+    } while(0)
+
+    if(len > 0 && raw[0] == '"') {
+        for(size_t i = 1; i < len; i++) {
+            char c = raw[i];
+            if(c == '"') {
+                if(i + 1 < len && raw[i + 1] == '"') i++;
+                else break; // the closing quote; anything after it is junk
+            }
+            else if(c == '\n' && raw[i - 1] == '\r') continue; // the \r already became a space
+            else if(c == '\n' || c == '\r') c = ' ';
+            EMIT(c);
+        }
+    }
+    else {
+        for(size_t i = 0; i < len; i++) EMIT(raw[i]);
+    }
+
+    #undef EMIT
+
+    // if the first byte that didn't fit was the middle of a UTF-8 character, drop the start of it too
+    if(truncated && (dropped & 0xc0) == 0x80) {
+        while(out > 0 && ((unsigned char) output_buf[out - 1] & 0xc0) == 0x80) out--;
+        if(out > 0) out--;
+    }
+
+    output_buf[out] = '\0';
+    return (unsigned int) out;
+}
+
+typedef struct {
+    Record record;
+    char values[MAX_RECORD_FIELDS][MAX_LINE_LENGTH];
+} RecordBuilder;
+
+// fields outside the mask are only counted, which saves copying out columns nobody asked for
+static void add_field(RecordBuilder * builder, const char * raw, size_t len, bool ends_record, unsigned long long field_mask) {
+    Record * record = &builder->record;
+    unsigned int field = record->num_fields;
+    if(field >= MAX_RECORD_FIELDS) return;
+
+    if(field_mask & (1ULL << field)) record->lengths[field] = unquote_field(raw, len, ends_record, builder->values[field]);
+    else {
+        builder->values[field][0] = '\0';
+        record->lengths[field] = 0;
+    }
+    record->num_fields++;
+}
+
+//------------------------------------------------------------------------------
+
+char detect_delimiter(const char * data, size_t size) {
+    const char * end = memchr(data, '\n', size);
+    size_t first_line = (end == NULL) ? size : (size_t) (end - data);
+    return (memchr(data, '\t', first_line) != NULL) ? '\t' : ',';
+}
+
+SorterError scan_records(const SorterAllocator * allocator, const char * data, size_t size, char delimiter, const unsigned long long * field_mask, record_handler handle_record, void * context, unsigned int * bad_line) {
+    RecordBuilder * builder = sorter_malloc(allocator, sizeof(RecordBuilder)); // MAX_RECORD_FIELDS line buffers are a lot for the stack
+    if(builder == NULL) return SORTER_ERR_OUT_OF_MEMORY;
+    for(int i = 0; i < MAX_RECORD_FIELDS; i++) builder->record.values[i] = builder->values[i];
+    builder->record.num_fields = 0;
+    builder->record.line = 1;
+
+    SorterError error = SORTER_OK;
+    unsigned long long inside_quotes = 0;   // all ones if the previous block ended inside quotes
+    unsigned int lines_before_block = 0;
+    size_t field_start = 0;
+
+    for(size_t block_start = 0; block_start < size && error == SORTER_OK; block_start += BLOCK_SIZE) {
+        const char * block = data + block_start;
+        char tail[BLOCK_SIZE];
+        if(size - block_start < BLOCK_SIZE) {
+            // the last bit of the input, padded with bytes that aren't anything
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, block, size - block_start);
+            block = tail;
+        }
+
+        BlockMasks masks = scan_block(block, delimiter);
+        unsigned long long quoted = prefix_xor(masks.quotes) ^ inside_quotes;
+        inside_quotes = 0ULL - (quoted >> (BLOCK_SIZE - 1));
+
+        unsigned long long structurals = (masks.delimiters | masks.newlines) & ~quoted;
+        while(structurals != 0 && error == SORTER_OK) {
+            unsigned int bit = (unsigned int) __builtin_ctzll(structurals);
+            structurals &= structurals - 1;
+
+            size_t end = block_start + bit;
+            add_field(builder, data + field_start, end - field_start, data[end] == '\n', (field_mask != NULL) ? *field_mask : ~0ULL);
+            field_start = end + 1;
+
+            if(data[end] == '\n') {
+                error = handle_record(context, &builder->record);
+                builder->record.num_fields = 0;
+                builder->record.line = 1 + lines_before_block + newlines_through(masks.newlines, bit);
+            }
+        }
+
+        lines_before_block += (unsigned int) __builtin_popcountll(masks.newlines);
+    }
+
+    if(error == SORTER_OK && inside_quotes != 0) {
+        if(bad_line != NULL) *bad_line = builder->record.line;
+        error = SORTER_ERR_BAD_INPUT;
+    }
+
+    // no newline at the end of the file
+    if(error == SORTER_OK && (field_start < size || builder->record.num_fields > 0)) {
+        add_field(builder, data + field_start, size - field_start, true, (field_mask != NULL) ? *field_mask : ~0ULL);
+        error = handle_record(context, &builder->record);
+    }
+
+    sorter_free(allocator, builder);
+    return error;
+}
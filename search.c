@@ -0,0 +1,329 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "sorter.h"
+
+// trigrams are hashed into this many buckets; a collision only means a few extra entries get tallied
+#define TRIGRAM_BUCKET_BITS 16
+#define NUM_TRIGRAM_BUCKETS (1u << TRIGRAM_BUCKET_BITS)
+
+// a value can't be longer than a line, plus the padding
+#define MAX_TRIGRAMS (MAX_LINE_LENGTH + 3)
+
+//------------------------------------------------------------------------------
+// trigrams
+
+// lowercase letters and digits stay, anything else ASCII becomes a single space
+// non-ASCII bytes are kept as they are, so accented titles still get trigrams of their own
+// the result is padded with two spaces in front and one behind, so word starts count for a bit more
+static size_t normalize_for_trigrams(const char * value, char * output_buf, size_t output_buf_size) {
+    size_t len = 0;
+    output_buf[len++] = ' ';
+    output_buf[len++] = ' ';
+
+    for(size_t i = 0; (value[i] != '\0') && (len + 2 < output_buf_size); i++) {
+        unsigned char c = value[i];
+        if((c >= 'A') && (c <= 'Z')) c += 'a' - 'A';
+
+        bool keep = ((c >= 'a') && (c <= 'z')) || ((c >= '0') && (c <= '9')) || (c >= 0x80);
+        if(keep) output_buf[len++] = c;
+        else if(output_buf[len - 1] != ' ') output_buf[len++] = ' ';
+    }
+
+    if(len == 2) return 0; // nothing worth indexing
+    if(output_buf[len - 1] != ' ') output_buf[len++] = ' ';
+    output_buf[len] = '\0';
+
+    return len;
+}
+
+static unsigned int trigram_bucket(const char * gram) {
+    unsigned int packed = ((unsigned char) gram[0] << 16) | ((unsigned char) gram[1] << 8) | (unsigned char) gram[2];
+    return (packed * 2654435761u) >> (32 - TRIGRAM_BUCKET_BITS); // knuth's multiplicative hash
+}
+
+// the distinct trigram buckets of a value, ascending; returns how many
+static unsigned int collect_trigrams(const char * value, unsigned int * grams) {
+    char normalized[MAX_TRIGRAMS + 1];
+    size_t len = normalize_for_trigrams(value, normalized, sizeof(normalized));
+    if(len < 3) return 0;
+
+    unsigned int num_grams = 0;
+    for(size_t i = 0; i + 3 <= len; i++) {
+        unsigned int gram = trigram_bucket(normalized + i);
+
+        // insertion sort; titles are short, so this beats qsort() and drops duplicates on the way
+        unsigned int j = num_grams;
+        while(j > 0 && grams[j - 1] > gram) j--;
+        if(j > 0 && grams[j - 1] == gram) continue;
+        memmove(grams + j + 1, grams + j, (num_grams - j) * sizeof(unsigned int));
+        grams[j] = gram;
+        num_grams++;
+    }
+
+    return num_grams;
+}
+
+//------------------------------------------------------------------------------
+// index
+
+static void destroy_trigram_index(const SorterAllocator * allocator, TrigramIndex * index) {
+    sorter_free(allocator, index->bucket_starts);
+    sorter_free(allocator, index->entries);
+    sorter_free(allocator, index->num_grams);
+    memset(index, 0, sizeof(TrigramIndex));
+}
+
+// one entry per value of the column; for plain columns that's one per row
+// two passes over the values, counting then filling, so the entries come out in one exact-size array
+static SorterError build_trigram_index(const SorterAllocator * allocator, const StringColumn * column, TrigramIndex * index) {
+    memset(index, 0, sizeof(TrigramIndex));
+    index->num_entries = column->num_values;
+
+    index->bucket_starts = sorter_calloc(allocator, NUM_TRIGRAM_BUCKETS + 1, sizeof(unsigned int));
+    index->num_grams = sorter_malloc(allocator, (column->num_values + 1) * sizeof(unsigned short));
+    unsigned int * cursors = sorter_malloc(allocator, NUM_TRIGRAM_BUCKETS * sizeof(unsigned int));
+    if(index->bucket_starts == NULL || index->num_grams == NULL || cursors == NULL) {
+        sorter_free(allocator, cursors);
+        destroy_trigram_index(allocator, index);
+        return SORTER_ERR_OUT_OF_MEMORY;
+    }
+
+    unsigned int grams[MAX_TRIGRAMS];
+    size_t total = 0;
+
+    for(unsigned int v = 0; v < column->num_values; v++) {
+        unsigned int num_grams = collect_trigrams(column->blob + column->offsets[v], grams);
+        index->num_grams[v] = num_grams;
+        for(unsigned int g = 0; g < num_grams; g++) index->bucket_starts[grams[g] + 1]++;
+        total += num_grams;
+    }
+
+    for(unsigned int b = 0; b < NUM_TRIGRAM_BUCKETS; b++) index->bucket_starts[b + 1] += index->bucket_starts[b];
+
+    index->entries = sorter_malloc(allocator, (total + 1) * sizeof(unsigned int));
+    if(index->entries == NULL) {
+        sorter_free(allocator, cursors);
+        destroy_trigram_index(allocator, index);
+        return SORTER_ERR_OUT_OF_MEMORY;
+    }
+
+    memcpy(cursors, index->bucket_starts, NUM_TRIGRAM_BUCKETS * sizeof(unsigned int));
+    for(unsigned int v = 0; v < column->num_values; v++) {
+        unsigned int num_grams = collect_trigrams(column->blob + column->offsets[v], grams);
+        for(unsigned int g = 0; g < num_grams; g++) index->entries[cursors[grams[g]]++] = v;
+    }
+
+    sorter_free(allocator, cursors);
+    return SORTER_OK;
+}
+
+// where each row is on the shelf right now
+static void fill_positions(const Library * library, SearchIndex * index) {
+    for(unsigned int position = 0; position < library->num_books; position++) index->position_of[library->order[position]] = position;
+    index->shelf_version = library->shelf_version;
+}
+
+// the rows of each author, so an author that matches can be turned into books without looking at every row
+static SorterError build_author_rows(const Library * library, SearchIndex * index) {
+    unsigned int num_authors = library->columns[AUTHOR].num_values;
+    index->author_row_starts = sorter_calloc(index->allocator, num_authors + 1, sizeof(unsigned int));
+    index->author_rows = sorter_malloc(index->allocator, (library->num_books + 1) * sizeof(unsigned int));
+    unsigned int * cursors = sorter_malloc(index->allocator, (num_authors + 1) * sizeof(unsigned int));
+    if(index->author_row_starts == NULL || index->author_rows == NULL || cursors == NULL) {
+        sorter_free(index->allocator, cursors);
+        return SORTER_ERR_OUT_OF_MEMORY;
+    }
+
+    for(unsigned int row = 0; row < library->num_books; row++) index->author_row_starts[library_code(library, AUTHOR, row) + 1]++;
+    for(unsigned int a = 0; a < num_authors; a++) index->author_row_starts[a + 1] += index->author_row_starts[a];
+    memcpy(cursors, index->author_row_starts, num_authors * sizeof(unsigned int));
+    for(unsigned int row = 0; row < library->num_books; row++) index->author_rows[cursors[library_code(library, AUTHOR, row)]++] = row;
+
+    sorter_free(index->allocator, cursors);
+    return SORTER_OK;
+}
+
+SorterError build_search_index(const Library * library, SearchIndex * index) {
+    memset(index, 0, sizeof(SearchIndex));
+    index->allocator = library->allocator;
+
+    SorterError error = build_trigram_index(index->allocator, &library->columns[TITLE], &index->titles);
+    if(error == SORTER_OK) error = build_trigram_index(index->allocator, &library->columns[AUTHOR], &index->authors);
+    if(error == SORTER_OK) error = build_author_rows(library, index);
+    if(error == SORTER_OK) {
+        index->position_of = sorter_malloc(index->allocator, (library->num_books + 1) * sizeof(unsigned int));
+        if(index->position_of == NULL) error = SORTER_ERR_OUT_OF_MEMORY;
+        else fill_positions(library, index);
+    }
+    if(error != SORTER_OK) destroy_search_index(index);
+
+    return error;
+}
+
+SorterError library_search_index(Library * library, const SearchIndex ** index) {
+    if(library->search_index == NULL) {
+        SearchIndex * search_index = sorter_malloc(library->allocator, sizeof(SearchIndex));
+        if(search_index == NULL) return SORTER_ERR_OUT_OF_MEMORY;
+
+        SorterError error = build_search_index(library, search_index);
+        if(error != SORTER_OK) {
+            sorter_free(library->allocator, search_index);
+            return error;
+        }
+        library->search_index = search_index;
+    }
+    else if(library->search_index->shelf_version != library->shelf_version) fill_positions(library, library->search_index);
+
+    *index = library->search_index;
+    return SORTER_OK;
+}
+
+void destroy_search_index(SearchIndex * index) {
+    destroy_trigram_index(index->allocator, &index->titles);
+    destroy_trigram_index(index->allocator, &index->authors);
+    sorter_free(index->allocator, index->author_row_starts);
+    sorter_free(index->allocator, index->author_rows);
+    sorter_free(index->allocator, index->position_of);
+    index->author_row_starts = NULL;
+    index->author_rows = NULL;
+    index->position_of = NULL;
+}
+
+//------------------------------------------------------------------------------
+// lookups
+
+// how many of the query's trigrams each entry shares, and which entries share any, in touched[]
+// only the query's buckets are walked; the counters start out cleared by calloc(), which is one memset at worst
+static SorterError tally_shared(const SorterAllocator * allocator, const TrigramIndex * index, const unsigned int * grams, unsigned int num_grams, unsigned short ** shared_out, unsigned int ** touched_out, unsigned int * num_touched_out) {
+    unsigned int num_postings = 0;
+    for(unsigned int g = 0; g < num_grams; g++) num_postings += index->bucket_starts[grams[g] + 1] - index->bucket_starts[grams[g]];
+
+    unsigned short * shared = sorter_calloc(allocator, index->num_entries + 1, sizeof(unsigned short));
+    unsigned int * touched = sorter_malloc(allocator, ((num_postings < index->num_entries) ? num_postings : index->num_entries) * sizeof(unsigned int) + sizeof(unsigned int));
+    if(shared == NULL || touched == NULL) {
+        sorter_free(allocator, shared);
+        sorter_free(allocator, touched);
+        return SORTER_ERR_OUT_OF_MEMORY;
+    }
+
+    unsigned int num_touched = 0;
+    for(unsigned int g = 0; g < num_grams; g++) {
+        for(unsigned int i = index->bucket_starts[grams[g]]; i < index->bucket_starts[grams[g] + 1]; i++) {
+            unsigned int entry = index->entries[i];
+            if(shared[entry]++ == 0) touched[num_touched++] = entry;
+        }
+    }
+
+    *shared_out = shared;
+    *touched_out = touched;
+    *num_touched_out = num_touched;
+    return SORTER_OK;
+}
+
+static int compare_candidates(const void * a, const void * b) {
+    const SearchMatch * x = (const SearchMatch *) a;
+    const SearchMatch * y = (const SearchMatch *) b;
+    return (x->position > y->position) - (x->position < y->position);
+}
+
+static float dice(unsigned int shared, unsigned int num_query_grams, unsigned int num_entry_grams) {
+    if(shared == 0) return 0.0f;
+    return (2.0f * shared) / (float) (num_query_grams + num_entry_grams);
+}
+
+static void add_match(SearchResults * results, unsigned int position, float score) {
+    if(results->num_matches == MAX_SEARCH_RESULTS && score <= results->matches[MAX_SEARCH_RESULTS - 1].score) return;
+
+    // positions come in ascending, so going after equal scores keeps ties in shelf order
+    unsigned int j = (results->num_matches < MAX_SEARCH_RESULTS) ? results->num_matches++ : MAX_SEARCH_RESULTS - 1;
+    while(j > 0 && results->matches[j - 1].score < score) {
+        results->matches[j] = results->matches[j - 1];
+        j--;
+    }
+    results->matches[j].position = position;
+    results->matches[j].score = score;
+}
+
+SorterError search_library(const Library * library, const SearchIndex * index, const char * query, bool include_authors, SearchResults * results) {
+    const SorterAllocator * allocator = library->allocator;
+    results->num_matches = 0;
+
+    unsigned int grams[MAX_TRIGRAMS];
+    unsigned int num_grams = collect_trigrams(query, grams);
+    if(num_grams == 0) return SORTER_OK;
+
+    unsigned short * title_shared = NULL;
+    unsigned short * author_shared = NULL;
+    unsigned int * titles_touched = NULL;
+    unsigned int * authors_touched = NULL;
+    unsigned int num_titles_touched = 0;
+    unsigned int num_authors_touched = 0;
+    SearchMatch * candidates = NULL;
+    unsigned int * stale_positions = NULL;
+
+    SorterError error = tally_shared(allocator, &index->titles, grams, num_grams, &title_shared, &titles_touched, &num_titles_touched);
+    if(error == SORTER_OK && include_authors) error = tally_shared(allocator, &index->authors, grams, num_grams, &author_shared, &authors_touched, &num_authors_touched);
+
+    // the shelf was reordered since library_search_index() last saw it, so work out positions here
+    const unsigned int * position_of = index->position_of;
+    if(error == SORTER_OK && index->shelf_version != library->shelf_version) {
+        stale_positions = sorter_malloc(allocator, (library->num_books + 1) * sizeof(unsigned int));
+        if(stale_positions == NULL) error = SORTER_ERR_OUT_OF_MEMORY;
+        else {
+            for(unsigned int position = 0; position < library->num_books; position++) stale_positions[library->order[position]] = position;
+            position_of = stale_positions;
+        }
+    }
+
+    // one candidate per close enough title, and one per book of each close enough author
+    size_t num_candidates = 0;
+    size_t candidates_capacity = num_titles_touched;
+    for(unsigned int i = 0; error == SORTER_OK && i < num_authors_touched; i++) {
+        unsigned int author = authors_touched[i];
+        if(dice(author_shared[author], num_grams, index->authors.num_grams[author]) < SEARCH_MIN_SCORE) continue;
+        candidates_capacity += index->author_row_starts[author + 1] - index->author_row_starts[author];
+    }
+    if(error == SORTER_OK) {
+        candidates = sorter_malloc(allocator, (candidates_capacity + 1) * sizeof(SearchMatch));
+        if(candidates == NULL) error = SORTER_ERR_OUT_OF_MEMORY;
+    }
+
+    for(unsigned int i = 0; error == SORTER_OK && i < num_titles_touched; i++) {
+        unsigned int row = titles_touched[i];
+        float score = dice(title_shared[row], num_grams, index->titles.num_grams[row]);
+        if(score >= SEARCH_MIN_SCORE) candidates[num_candidates++] = (SearchMatch) { .position = position_of[row], .score = score };
+    }
+    for(unsigned int i = 0; error == SORTER_OK && i < num_authors_touched; i++) {
+        unsigned int author = authors_touched[i];
+        float score = dice(author_shared[author], num_grams, index->authors.num_grams[author]);
+        if(score < SEARCH_MIN_SCORE) continue;
+        for(unsigned int r = index->author_row_starts[author]; r < index->author_row_starts[author + 1]; r++) {
+            candidates[num_candidates++] = (SearchMatch) { .position = position_of[index->author_rows[r]], .score = score };
+        }
+    }
+
+    // a book can be a candidate by title and by author, and scores the better of the two
+    // going through them in shelf order keeps ties in shelf order
+    if(error == SORTER_OK) {
+        qsort(candidates, num_candidates, sizeof(SearchMatch), &compare_candidates);
+        for(size_t i = 0; i < num_candidates; ) {
+            SearchMatch best = candidates[i++];
+            while(i < num_candidates && candidates[i].position == best.position) {
+                if(candidates[i].score > best.score) best.score = candidates[i].score;
+                i++;
+            }
+            add_match(results, best.position, best.score);
+        }
+    }
+
+    sorter_free(allocator, title_shared);
+    sorter_free(allocator, author_shared);
+    sorter_free(allocator, titles_touched);
+    sorter_free(allocator, authors_touched);
+    sorter_free(allocator, candidates);
+    sorter_free(allocator, stale_positions);
+    return error;
+}
@@ -0,0 +1,474 @@
+#define _POSIX_C_SOURCE 200809L // open_memstream(), st_mtim
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "sorter.h"
+
+// the protocol, one request per line:
+// COUNT                    number of books
+// PAGE <first> <count>     books at shelf numbers first .. first + count - 1 (shelf numbers start at 1)
+// WHERE <predicates>       books matching a --where expression
+// SEARCH <text>            closest titles and authors, best first, like --search
+// POSITION <title>         where a title is on the shelf; the closest title if it isn't there exactly
+// RENDER <txt|html|web>    the whole shelf, exactly as the command line would write it
+// RELOAD                   reload the input now rather than waiting to notice it changed
+// QUIT                     close the connection
+// replies are "OK <bytes>\n" followed by that many bytes, or "ERR <message>\n"
+// replies are queued and sent as the client reads them, so one slow client never holds up the others;
+// while a client has more than MAX_CLIENT_BACKLOG unread, its next requests wait, and if it reads
+// nothing at all for CLIENT_STALL_MS it's dropped
+// listings are one book per line: "<shelf number>\t<title>\t<author>", with "\t<score>" after the
+// shelf number for SEARCH and POSITION
+
+#define MAX_CLIENTS 64
+#define RELOAD_CHECK_MS 500 // how often to look at the input file's mtime
+#define MAX_REQUEST_LENGTH (2 * MAX_LINE_LENGTH)
+#define MAX_CLIENT_BACKLOG (1 << 20)
+#define CLIENT_STALL_MS 30000
+
+// everything a request might need, loaded together and replaced together
+typedef struct {
+    Library library;
+    LibraryIndex index;
+    const SearchIndex * search_index;   // owned by the library
+    struct timespec mtime;              // of the input file this was loaded from
+    off_t size;
+} Catalog;
+
+typedef struct {
+    int fd;
+    char request[MAX_REQUEST_LENGTH];
+    size_t request_length;
+    bool discarding;            // the request was too long, so the rest of its line is skipped
+    bool quitting;              // sent QUIT; closed once the replies before that are sent
+    bool hung_up;               // sent everything it's going to; closed once it's all answered
+
+    char * output;              // queued replies; output[output_sent .. output_length) is still to go
+    size_t output_length;
+    size_t output_sent;
+    size_t output_capacity;
+    long long last_progress;    // milliseconds_now() when the client last took any of it
+} Client;
+
+//------------------------------------------------------------------------------
+// loading
+
+static void destroy_catalog(const ServeOptions * options, Catalog * catalog) {
+    destroy_index(&catalog->index);
+    destroy_library(&catalog->library);
+    sorter_free(options->allocator, catalog);
+}
+
+// the same pipeline main() runs, stopping short of output
+static SorterError load_catalog(const ServeOptions * options, Catalog ** catalog_out) {
+    Catalog * catalog = sorter_calloc(options->allocator, 1, sizeof(Catalog));
+    if(catalog == NULL) return SORTER_ERR_OUT_OF_MEMORY;
+
+    struct stat input_stat;
+    FILE * input_file = fopen(options->input_filename, "r");
+    if(input_file == NULL || fstat(fileno(input_file), &input_stat) != 0) {
+        if(input_file != NULL) fclose(input_file);
+        fprintf(stderr, "ERROR: %s!\n", sorter_strerror(SORTER_ERR_INPUT_FILE));
+        sorter_free(options->allocator, catalog);
+        return SORTER_ERR_INPUT_FILE;
+    }
+    catalog->mtime = input_stat.st_mtim;
+    catalog->size = input_stat.st_size;
+
+    SorterError error = parse_library(input_file, options->allocator, &catalog->library);
+    if(error != SORTER_OK) {
+        fprintf(stderr, "ERROR: %s!\n %s!\n", sorter_strerror(error), catalog->library.error_detail);
+        sorter_free(options->allocator, catalog);
+        return error;
+    }
+
+    Library * library = &catalog->library;
+    error = sort_library(library, &options->order);
+
+    if(error == SORTER_OK && options->add_collections != NULL && order_keeps_authors_together(&options->order)) {
+        error = options->add_collections(library);
+        if(error == SORTER_OK) apply_collections(library);
+    }
+
+    if(error == SORTER_OK) error = build_index(library, &catalog->index);
+    if(error == SORTER_OK) error = library_search_index(library, &catalog->search_index); // build it now rather than on the first SEARCH
+
+    if(error != SORTER_OK) {
+        fprintf(stderr, "ERROR: %s!\n %s!\n", sorter_strerror(error), library->error_detail);
+        destroy_catalog(options, catalog);
+        return error;
+    }
+
+    *catalog_out = catalog;
+    return SORTER_OK;
+}
+
+static bool same_file_version(const struct stat * input_stat, struct timespec mtime, off_t size) {
+    return (input_stat->st_mtim.tv_sec == mtime.tv_sec) && (input_stat->st_mtim.tv_nsec == mtime.tv_nsec) && (input_stat->st_size == size);
+}
+
+// swaps in a freshly loaded catalog, or keeps the current one if the new one doesn't load
+static SorterError reload_catalog(const ServeOptions * options, Catalog ** current) {
+    Catalog * fresh;
+    SorterError error = load_catalog(options, &fresh);
+    if(error != SORTER_OK) return error;
+
+    destroy_catalog(options, *current);
+    *current = fresh;
+    fprintf(stderr, "reloaded %s: %u books\n", options->input_filename, fresh->library.num_books);
+    return SORTER_OK;
+}
+
+//------------------------------------------------------------------------------
+// requests
+
+static void write_book(const Catalog * catalog, FILE * reply, unsigned int position) {
+    unsigned int row = catalog->library.order[position];
+    fprintf(reply, "%u\t%s\t%s\n", position + 1, library_value(&catalog->library, TITLE, row), library_value(&catalog->library, AUTHOR, row));
+}
+
+static void write_scored_book(const Catalog * catalog, FILE * reply, unsigned int position, float score) {
+    unsigned int row = catalog->library.order[position];
+    fprintf(reply, "%u\t%.2f\t%s\t%s\n", position + 1, score, library_value(&catalog->library, TITLE, row), library_value(&catalog->library, AUTHOR, row));
+}
+
+// writes the reply's body; returns NULL, or the message for an ERR
+static const char * answer_request(const Catalog * catalog, const char * command, const char * argument, FILE * reply) {
+    const Library * library = &catalog->library;
+
+    if(str_equal(command, "COUNT")) {
+        fprintf(reply, "%u\n", library->num_books);
+    }
+    else if(str_equal(command, "PAGE")) {
+        unsigned int first, count;
+        if(sscanf(argument, "%u %u", &first, &count) != 2 || first == 0) return "PAGE needs a first shelf number (from 1) and a count";
+
+        for(unsigned int position = first - 1; (position < library->num_books) && (position - (first - 1) < count); position++) {
+            write_book(catalog, reply, position);
+        }
+    }
+    else if(str_equal(command, "WHERE")) {
+        Query query = { 0 };
+        Selection selection;
+        if(parse_query(argument, &query) != SORTER_OK) return "could not understand query";
+        if(run_query(library, &catalog->index, &query, &selection) != SORTER_OK) return "out of memory";
+
+        for(unsigned int i = 0; i < selection.num_positions; i++) write_book(catalog, reply, selection.positions[i]);
+        destroy_selection(&selection);
+    }
+    else if(str_equal(command, "SEARCH")) {
+        SearchResults results;
+        if(search_library(library, catalog->search_index, argument, true, &results) != SORTER_OK) return "out of memory";
+
+        for(unsigned int i = 0; i < results.num_matches; i++) write_scored_book(catalog, reply, results.matches[i].position, results.matches[i].score);
+    }
+    else if(str_equal(command, "POSITION")) {
+        int position = get_by[TITLE](library, argument);
+        if(position >= 0) write_scored_book(catalog, reply, position, 1.0f);
+        else {
+            SearchResults results;
+            if(search_library(library, catalog->search_index, argument, false, &results) != SORTER_OK) return "out of memory";
+            if(results.num_matches == 0) return "no such title";
+            write_scored_book(catalog, reply, results.matches[0].position, results.matches[0].score);
+        }
+    }
+    else if(str_equal(command, "RENDER")) {
+        OutputFormat format;
+        if(str_equal(argument, "txt")) format = OUTPUT_TXT;
+        else if(str_equal(argument, "html")) format = OUTPUT_HTML;
+        else if(str_equal(argument, "web")) format = OUTPUT_WEBSITE;
+        else return "RENDER needs txt, html or web";
+
+        do_output(library, reply, format);
+    }
+    else return "unknown request";
+
+    return NULL;
+}
+
+static long long milliseconds_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static size_t pending_output(const Client * client) {
+    return client->output_length - client->output_sent;
+}
+
+// false if there's no memory for it, in which case the client is dropped
+static bool queue_output(const ServeOptions * options, Client * client, const char * data, size_t length) {
+    if(pending_output(client) == 0) {
+        client->output_length = 0;
+        client->output_sent = 0;
+        client->last_progress = milliseconds_now(); // the clock starts when there's something to read
+    }
+
+    if(client->output_length + length > client->output_capacity && client->output_sent > 0) {
+        // the sent part goes first, then the buffer grows if that wasn't enough
+        memmove(client->output, client->output + client->output_sent, pending_output(client));
+        client->output_length -= client->output_sent;
+        client->output_sent = 0;
+    }
+
+    if(client->output_length + length > client->output_capacity) {
+        size_t capacity = (client->output_capacity == 0) ? 4096 : client->output_capacity;
+        while(client->output_length + length > capacity) capacity *= 2;
+        char * bigger = sorter_realloc(options->allocator, client->output, capacity);
+        if(bigger == NULL) return false;
+        client->output = bigger;
+        client->output_capacity = capacity;
+    }
+
+    memcpy(client->output + client->output_length, data, length);
+    client->output_length += length;
+    return true;
+}
+
+static bool queue_error(const ServeOptions * options, Client * client, const char * message) {
+    char line[MAX_LINE_LENGTH];
+    int length = snprintf(line, sizeof(line), "ERR %s\n", message);
+    return queue_output(options, client, line, length);
+}
+
+// sends as much as the socket takes right now; false if the connection should be closed
+static bool flush_output(Client * client) {
+    while(pending_output(client) > 0) {
+        ssize_t sent = send(client->fd, client->output + client->output_sent, pending_output(client), 0);
+        if(sent < 0) {
+            if(errno == EINTR) continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK); // full; poll() says when there's room
+        }
+        client->output_sent += sent;
+        client->last_progress = milliseconds_now();
+    }
+    return true;
+}
+
+// false if the connection should be closed
+static bool handle_request(const ServeOptions * options, Catalog ** catalog, Client * client, char * request) {
+    // "COMMAND argument..."
+    char * argument = strchr(request, ' ');
+    if(argument != NULL) *(argument++) = '\0';
+    else argument = "";
+
+    if(str_equal(request, "QUIT")) {
+        client->quitting = true;
+        return true;
+    }
+
+    if(str_equal(request, "RELOAD")) {
+        SorterError error = reload_catalog(options, catalog);
+        if(error != SORTER_OK) return queue_error(options, client, sorter_strerror(error));
+        return queue_output(options, client, "OK 0\n", 5);
+    }
+
+    char * body = NULL;
+    size_t body_length = 0;
+    FILE * reply = open_memstream(&body, &body_length);
+    if(reply == NULL) return queue_error(options, client, "out of memory");
+
+    const char * message = answer_request(*catalog, request, argument, reply);
+    fclose(reply);
+
+    bool ok;
+    if(message != NULL) ok = queue_error(options, client, message);
+    else {
+        char header[32];
+        int header_length = snprintf(header, sizeof(header), "OK %zu\n", body_length);
+        ok = queue_output(options, client, header, header_length) && queue_output(options, client, body, body_length);
+    }
+
+    free(body);
+    return ok;
+}
+
+// runs the complete lines the client has sent, until it has too much unread; false if the connection should be closed
+static bool run_requests(const ServeOptions * options, Catalog ** catalog, Client * client) {
+    char * start = client->request;
+    char * end = client->request + client->request_length;
+    char * newline;
+    bool ok = true;
+
+    while(ok && !client->quitting && pending_output(client) < MAX_CLIENT_BACKLOG && (newline = memchr(start, '\n', end - start)) != NULL) {
+        *newline = '\0';
+        if(client->discarding) client->discarding = false; // the end of the line that was too long
+        else {
+            if(newline > start && *(newline - 1) == '\r') *(newline - 1) = '\0';
+            ok = handle_request(options, catalog, client, start);
+        }
+        start = newline + 1;
+    }
+
+    // keep the unfinished line (and anything not run yet) for next time
+    client->request_length = end - start;
+    memmove(client->request, start, client->request_length);
+
+    if(ok && client->discarding) client->request_length = 0; // still in the line that was too long
+    if(ok && client->request_length == sizeof(client->request) && memchr(client->request, '\n', client->request_length) == NULL) {
+        client->request_length = 0;
+        client->discarding = true;
+        ok = queue_error(options, client, "request too long");
+    }
+
+    return ok;
+}
+
+// false if the connection should be closed
+static bool read_requests(Client * client) {
+    if(client->hung_up || client->request_length == sizeof(client->request)) return true; // nothing to read into until some of it runs
+
+    ssize_t received = recv(client->fd, client->request + client->request_length, sizeof(client->request) - client->request_length, 0);
+    if(received < 0) return (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK);
+    if(received == 0) client->hung_up = true; // whatever it asked for before hanging up still gets answered
+    client->request_length += received;
+    return true;
+}
+
+static bool finished(const Client * client) {
+    if(pending_output(client) > 0) return false;
+    return client->quitting || (client->hung_up && memchr(client->request, '\n', client->request_length) == NULL);
+}
+
+static void close_client(const ServeOptions * options, Client * client) {
+    close(client->fd);
+    sorter_free(options->allocator, client->output);
+}
+
+//------------------------------------------------------------------------------
+
+static SorterError open_socket(const char * socket_path, int * listen_fd) {
+    struct sockaddr_un address = { 0 };
+    address.sun_family = AF_UNIX;
+    if(strlen(socket_path) >= sizeof(address.sun_path)) return SORTER_ERR_SOCKET;
+    strcpy(address.sun_path, socket_path);
+
+    // a socket left over from a server that didn't exit cleanly; anything else at that path is left alone
+    struct stat path_stat;
+    if(stat(socket_path, &path_stat) == 0 && S_ISSOCK(path_stat.st_mode)) unlink(socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) return SORTER_ERR_SOCKET;
+    if(bind(fd, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(fd, MAX_CLIENTS) != 0) {
+        close(fd);
+        return SORTER_ERR_SOCKET;
+    }
+
+    *listen_fd = fd;
+    return SORTER_OK;
+}
+
+SorterError serve_library(const ServeOptions * options) {
+    Catalog * catalog;
+    SorterError error = load_catalog(options, &catalog);
+    if(error != SORTER_OK) return error;
+
+    int listen_fd;
+    if((error = open_socket(options->socket_path, &listen_fd)) != SORTER_OK) {
+        destroy_catalog(options, catalog);
+        return error;
+    }
+
+    signal(SIGPIPE, SIG_IGN); // a client hanging up mid-reply shouldn't take the server with it
+    fprintf(stderr, "serving %s (%u books) on %s\n", options->input_filename, catalog->library.num_books, options->socket_path);
+
+    Client clients[MAX_CLIENTS];
+    unsigned int num_clients = 0;
+    struct pollfd fds[MAX_CLIENTS + 1];
+
+    // a reload that failed is only retried once the file changes again
+    struct timespec failed_mtime = { 0 };
+    off_t failed_size = -1;
+    long long last_check = milliseconds_now();
+
+    while(!*options->stop) {
+        fds[0].fd = listen_fd;
+        fds[0].events = POLLIN;
+        for(unsigned int i = 0; i < num_clients; i++) {
+            const Client * client = &clients[i];
+            fds[i + 1].fd = client->fd;
+            fds[i + 1].events = 0;
+            // a client with a lot unread doesn't get to ask for more until it catches up
+            if(!client->quitting && !client->hung_up && pending_output(client) < MAX_CLIENT_BACKLOG && client->request_length < sizeof(client->request)) fds[i + 1].events |= POLLIN;
+            if(pending_output(client) > 0) fds[i + 1].events |= POLLOUT;
+        }
+
+        int ready = poll(fds, num_clients + 1, RELOAD_CHECK_MS);
+        if(ready < 0) {
+            if(errno == EINTR) continue; // probably the signal that set stop
+            error = SORTER_ERR_SOCKET;
+            break;
+        }
+
+        if(milliseconds_now() - last_check >= RELOAD_CHECK_MS) {
+            last_check = milliseconds_now();
+            struct stat input_stat;
+            if(stat(options->input_filename, &input_stat) == 0
+                && !same_file_version(&input_stat, catalog->mtime, catalog->size)
+                && !same_file_version(&input_stat, failed_mtime, failed_size)) {
+                if(reload_catalog(options, &catalog) != SORTER_OK) {
+                    failed_mtime = input_stat.st_mtim;
+                    failed_size = input_stat.st_size;
+                }
+            }
+        }
+
+        // backwards, so a closed client can be swapped with the last one without skipping anybody
+        long long now = milliseconds_now();
+        for(unsigned int i = num_clients; i > 0; i--) {
+            Client * client = &clients[i - 1];
+            short revents = (ready > 0) ? fds[i].revents : 0;
+            bool ok = true;
+
+            if(revents & (POLLOUT | POLLHUP | POLLERR)) ok = flush_output(client);
+            if(ok && (revents & POLLERR)) ok = false;
+            if(ok && (revents & (POLLIN | POLLHUP))) ok = read_requests(client);
+            if(ok) ok = run_requests(options, &catalog, client); // including any that waited for the backlog to drain
+            if(ok) ok = flush_output(client);
+
+            if(ok && pending_output(client) > 0 && now - client->last_progress > CLIENT_STALL_MS) ok = false; // not reading
+            if(ok && finished(client)) ok = false;
+
+            if(!ok) {
+                close_client(options, client);
+                clients[i - 1] = clients[--num_clients];
+            }
+        }
+
+        if(ready == 0) continue;
+
+        if(fds[0].revents & POLLIN) {
+            int fd = accept(listen_fd, NULL, NULL);
+            if(fd >= 0) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+            if(fd >= 0 && num_clients == MAX_CLIENTS) {
+                const char * message = "ERR too many connections\n";
+                if(send(fd, message, strlen(message), 0) < 0) { } // best effort; it's being turned away anyway
+                close(fd);
+            }
+            else if(fd >= 0) {
+                memset(&clients[num_clients], 0, sizeof(Client));
+                clients[num_clients].fd = fd;
+                num_clients++;
+            }
+        }
+    }
+
+    for(unsigned int i = 0; i < num_clients; i++) close_client(options, &clients[i]);
+    close(listen_fd);
+    unlink(options->socket_path);
+    destroy_catalog(options, catalog);
+
+    return error;
+}
@@ -0,0 +1,304 @@
+#define _POSIX_C_SOURCE 200809L // open_memstream()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "sorter.h"
+
+// a page's file name, without the directory
+#define MAX_PAGE_NAME 32
+
+// "<hash>\t<file name>" per page, index included
+#define SITE_MANIFEST "manifest.txt"
+
+typedef struct {
+    char name[MAX_PAGE_NAME];
+    char label[MAX_PAGE_NAME];      // what the index calls it
+    unsigned int begin;             // into positions
+    unsigned int end;
+} SitePage;
+
+typedef struct {
+    char name[MAX_PAGE_NAME];
+    unsigned long long hash;
+    bool still_there;               // this run wrote (or kept) it too
+} ManifestEntry;
+
+//------------------------------------------------------------------------------
+// splitting the shelf into pages
+
+// FNV-1a, 64 bit; only has to notice that a page changed
+static unsigned long long hash_bytes(const char * bytes, size_t len) {
+    unsigned long long hash = 14695981039346656037ull;
+    for(size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// the letter an author's page is filed under, taken from the same sanitize_title() form the shelf is sorted by,
+// so "The Beatles" is a B and "Émile Zola" an M; a number (its length byte) or nothing at all goes under '#'
+static char page_letter(const char * author) {
+    char sanitized[MAX_LINE_LENGTH];
+    sanitize_title(author, sanitized, sizeof(sanitized));
+    char c = sanitized[0];
+    if(c >= 'a' && c <= 'z') return c - 'a' + 'A';
+    return '#';
+}
+
+// one page per letter of the author when the order keeps authors together, SITE_PAGE_SIZE books a page otherwise
+// the letters come from the sort key, so each one is a single run of the shelf and a page's name never depends
+// on what's around it; '#' sorts first, since length bytes are below any letter
+static SorterError split_pages(const Library * library, const ShelfOrder * order, const unsigned int * positions, unsigned int num_positions, SitePage ** pages_out, unsigned int * num_pages_out) {
+    bool by_letter = order_keeps_authors_together(order);
+    unsigned int capacity = by_letter ? 32 : num_positions / SITE_PAGE_SIZE + 1;
+    SitePage * pages = sorter_malloc(library->allocator, capacity * sizeof(SitePage));
+    if(pages == NULL) return SORTER_ERR_OUT_OF_MEMORY;
+    unsigned int num_pages = 0;
+
+    for(unsigned int begin = 0; begin < num_positions; ) {
+        unsigned int end = begin + 1;
+        char letter = 0;
+
+        if(by_letter) {
+            letter = page_letter(library_value(library, AUTHOR, library->order[positions[begin]]));
+            while(end < num_positions && page_letter(library_value(library, AUTHOR, library->order[positions[end]])) == letter) end++;
+        }
+        else end = (num_positions - begin > SITE_PAGE_SIZE) ? begin + SITE_PAGE_SIZE : num_positions;
+
+        if(num_pages >= capacity) {
+            capacity *= 2;
+            SitePage * bigger = sorter_realloc(library->allocator, pages, capacity * sizeof(SitePage));
+            if(bigger == NULL) {
+                sorter_free(library->allocator, pages);
+                return SORTER_ERR_OUT_OF_MEMORY;
+            }
+            pages = bigger;
+        }
+
+        SitePage * page = &pages[num_pages];
+        page->begin = begin;
+        page->end = end;
+        if(by_letter) {
+            char stem[8] = { letter, '\0' };
+            if(letter == '#') snprintf(stem, sizeof(stem), "other");
+            snprintf(page->label, sizeof(page->label), "%c", letter);
+            snprintf(page->name, sizeof(page->name), "%s.html", stem);
+        }
+        else {
+            snprintf(page->label, sizeof(page->label), "%u", num_pages + 1);
+            snprintf(page->name, sizeof(page->name), "page-%u.html", num_pages + 1);
+        }
+
+        num_pages++;
+        begin = end;
+    }
+
+    *pages_out = pages;
+    *num_pages_out = num_pages;
+    return SORTER_OK;
+}
+
+//------------------------------------------------------------------------------
+// the manifest
+
+static SorterError read_manifest(const SorterAllocator * allocator, const char * path, ManifestEntry ** entries_out, unsigned int * num_entries_out) {
+    *entries_out = NULL;
+    *num_entries_out = 0;
+
+    FILE * manifest = fopen(path, "r");
+    if(manifest == NULL) return SORTER_OK; // first run
+
+    ManifestEntry * entries = NULL;
+    unsigned int num_entries = 0;
+    unsigned int capacity = 0;
+    char line[MAX_LINE_LENGTH];
+
+    while(fgets(line, sizeof(line), manifest) != NULL) {
+        ManifestEntry entry = { 0 };
+        char name[MAX_LINE_LENGTH];
+        if(sscanf(line, "%llx\t%511s", &entry.hash, name) != 2 || strlen(name) >= MAX_PAGE_NAME) continue; // not ours
+        memcpy(entry.name, name, strlen(name) + 1);
+
+        if(num_entries >= capacity) {
+            capacity = (capacity == 0) ? 32 : capacity * 2;
+            ManifestEntry * bigger = sorter_realloc(allocator, entries, capacity * sizeof(ManifestEntry));
+            if(bigger == NULL) {
+                sorter_free(allocator, entries);
+                fclose(manifest);
+                return SORTER_ERR_OUT_OF_MEMORY;
+            }
+            entries = bigger;
+        }
+        entries[num_entries++] = entry;
+    }
+
+    fclose(manifest);
+    *entries_out = entries;
+    *num_entries_out = num_entries;
+    return SORTER_OK;
+}
+
+static ManifestEntry * find_entry(ManifestEntry * entries, unsigned int num_entries, const char * name) {
+    for(unsigned int i = 0; i < num_entries; i++) {
+        if(str_equal(entries[i].name, name)) return &entries[i];
+    }
+    return NULL;
+}
+
+// only ever a page split_pages() could have made ("A.html", "other.html", "page-3.html");
+// the manifest is just a file, so it could say anything, and anything else in the directory isn't ours
+static bool is_page_name(const char * name) {
+    if(str_equal(name, "other.html")) return true;
+    if(name[0] >= 'A' && name[0] <= 'Z' && str_equal(name + 1, ".html")) return true;
+
+    if(strncmp(name, "page-", strlen("page-")) != 0) return false;
+    const char * digits = name + strlen("page-");
+    size_t num_digits = strspn(digits, "0123456789");
+    return num_digits > 0 && digits[0] != '0' && str_equal(digits + num_digits, ".html");
+}
+
+//------------------------------------------------------------------------------
+
+static bool file_exists(const char * path) {
+    struct stat path_stat;
+    return stat(path, &path_stat) == 0;
+}
+
+// written next to the old file and renamed over it, so the web server never sees half a page
+static SorterError replace_file(const char * path, const char * bytes, size_t len) {
+    char temporary[2 * MAX_LINE_LENGTH];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+
+    FILE * file = fopen(temporary, "w");
+    if(file == NULL) return SORTER_ERR_OUTPUT_FILE;
+    bool ok = (fwrite(bytes, 1, len, file) == len);
+    if(fclose(file) != 0) ok = false;
+
+    if(!ok || rename(temporary, path) != 0) {
+        remove(temporary);
+        return SORTER_ERR_OUTPUT_FILE;
+    }
+    return SORTER_OK;
+}
+
+// writes a page if its hash isn't the one the manifest has for it (or the file has gone missing)
+static SorterError publish_page(const char * output_dir, const char * name, const char * bytes, size_t len, ManifestEntry * old_entries, unsigned int num_old_entries, FILE * manifest, SiteSummary * summary) {
+    char path[2 * MAX_LINE_LENGTH];
+    snprintf(path, sizeof(path), "%s/%s", output_dir, name);
+
+    unsigned long long hash = hash_bytes(bytes, len);
+    ManifestEntry * old = find_entry(old_entries, num_old_entries, name);
+    if(old != NULL) old->still_there = true;
+
+    if(old != NULL && old->hash == hash && file_exists(path)) summary->num_unchanged++;
+    else {
+        SorterError error = replace_file(path, bytes, len);
+        if(error != SORTER_OK) {
+            snprintf(summary->error_detail, sizeof(summary->error_detail), "could not write %s", path);
+            return error;
+        }
+        summary->num_written++;
+    }
+
+    fprintf(manifest, "%016llx\t%s\n", hash, name);
+    summary->num_pages++;
+    return SORTER_OK;
+}
+
+SorterError write_site(const Library * library, const ShelfOrder * order, const unsigned int * positions, unsigned int num_positions, const char * output_dir, SiteSummary * summary) {
+    memset(summary, 0, sizeof(SiteSummary));
+    const SorterAllocator * allocator = library->allocator;
+
+    if(mkdir(output_dir, 0777) != 0 && errno != EEXIST) {
+        snprintf(summary->error_detail, sizeof(summary->error_detail), "could not make %s", output_dir);
+        return SORTER_ERR_OUTPUT_FILE;
+    }
+
+    // everything below works on a list of positions, so the whole shelf is one too
+    unsigned int * all_positions = NULL;
+    if(positions == NULL) {
+        all_positions = sorter_malloc(allocator, (num_positions + 1) * sizeof(unsigned int));
+        if(all_positions == NULL) return SORTER_ERR_OUT_OF_MEMORY;
+        for(unsigned int i = 0; i < num_positions; i++) all_positions[i] = i;
+        positions = all_positions;
+    }
+
+    char manifest_path[2 * MAX_LINE_LENGTH];
+    snprintf(manifest_path, sizeof(manifest_path), "%s/%s", output_dir, SITE_MANIFEST);
+
+    SitePage * pages = NULL;
+    unsigned int num_pages = 0;
+    ManifestEntry * old_entries = NULL;
+    unsigned int num_old_entries = 0;
+    char * manifest_text = NULL;
+    size_t manifest_length = 0;
+    FILE * manifest = NULL;
+
+    SorterError error = split_pages(library, order, positions, num_positions, &pages, &num_pages);
+    if(error == SORTER_OK) error = read_manifest(allocator, manifest_path, &old_entries, &num_old_entries);
+    if(error == SORTER_OK && (manifest = open_memstream(&manifest_text, &manifest_length)) == NULL) error = SORTER_ERR_OUT_OF_MEMORY;
+
+    // each page is rendered into memory first, so it can be hashed before deciding to write it
+    for(unsigned int p = 0; error == SORTER_OK && p < num_pages; p++) {
+        char * page_text = NULL;
+        size_t page_length = 0;
+        FILE * page = open_memstream(&page_text, &page_length);
+        if(page == NULL) {
+            error = SORTER_ERR_OUT_OF_MEMORY;
+            break;
+        }
+
+        fputs("<p><a href=\"index.html\">index</a></p>", page);
+        do_output_positions(library, positions + pages[p].begin, pages[p].end - pages[p].begin, page, OUTPUT_WEBSITE);
+        fclose(page);
+
+        error = publish_page(output_dir, pages[p].name, page_text, page_length, old_entries, num_old_entries, manifest, summary);
+        free(page_text);
+    }
+
+    // the index only names the pages, so adding a book doesn't change it unless it starts a new page
+    if(error == SORTER_OK) {
+        char * index_text = NULL;
+        size_t index_length = 0;
+        FILE * index = open_memstream(&index_text, &index_length);
+        if(index == NULL) error = SORTER_ERR_OUT_OF_MEMORY;
+        else {
+            fputs("<ul>", index);
+            for(unsigned int p = 0; p < num_pages; p++) fprintf(index, "<li><a href=\"%s\">%s</a></li>", pages[p].name, pages[p].label);
+            fputs("</ul>", index);
+            fclose(index);
+
+            error = publish_page(output_dir, "index.html", index_text, index_length, old_entries, num_old_entries, manifest, summary);
+            free(index_text);
+        }
+    }
+
+    if(manifest != NULL) fclose(manifest);
+
+    // pages that aren't part of the site any more
+    for(unsigned int i = 0; error == SORTER_OK && i < num_old_entries; i++) {
+        if(old_entries[i].still_there || !is_page_name(old_entries[i].name)) continue;
+        char path[2 * MAX_LINE_LENGTH];
+        snprintf(path, sizeof(path), "%s/%s", output_dir, old_entries[i].name);
+        if(remove(path) == 0) summary->num_removed++;
+    }
+
+    // the manifest goes last, so if anything above failed the next run redoes the pages it didn't get to
+    if(error == SORTER_OK && (summary->num_written > 0 || summary->num_removed > 0 || !file_exists(manifest_path))) {
+        error = replace_file(manifest_path, manifest_text, manifest_length);
+        if(error != SORTER_OK) snprintf(summary->error_detail, sizeof(summary->error_detail), "could not write %s", manifest_path);
+    }
+
+    free(manifest_text);
+    sorter_free(allocator, old_entries);
+    sorter_free(allocator, pages);
+    sorter_free(allocator, all_positions);
+    return error;
+}
@@ -0,0 +1,1746 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "sorter.h"
+
+//------------------------------------------------------------------------------
+
+const char * sorter_strerror(SorterError error) {
+    switch(error) {
+        case SORTER_OK: return "no error";
+        case SORTER_ERR_USAGE: return "bad arguments";
+        case SORTER_ERR_INPUT_FILE: return "could not open input file";
+        case SORTER_ERR_OUTPUT_FILE: return "could not open output file";
+        case SORTER_ERR_HEADER: return "header has no title or author column";
+        case SORTER_ERR_OUT_OF_MEMORY: return "out of memory";
+        case SORTER_ERR_BAD_COLLECTION: return "a collection needs at least two titles";
+        case SORTER_ERR_TITLE_NOT_FOUND: return "collection title is not in the library";
+        case SORTER_ERR_BAD_QUERY: return "could not understand query";
+        case SORTER_ERR_BAD_ORDER: return "could not understand shelf order";
+        case SORTER_ERR_SOCKET: return "could not open socket";
+        case SORTER_ERR_BAD_INPUT: return "could not parse input file";
+    }
+    return "unknown error";
+}
+
+const bool FIELD_IS_DICTIONARY[EXPECTED_NUMBER_OF_FIELDS] = {
+    [AUTHOR] = true,        // thousands of books per prolific author
+    [CONTRIBUTOR] = true,   // same for translators, and most books have none
+    [SUBJECT] = true,
+    [STATUS] = true,        // "None", "Partial", "Complete"
+    [DATE] = true,          // a few per month at most; sorted by date rather than alphabetically, see date_priority()
+};
+
+const char * const FIELD_NAMES[EXPECTED_NUMBER_OF_FIELDS] = {
+    [TITLE] = "title",
+    [AUTHOR] = "author",
+    [CONTRIBUTOR] = "contributor",
+    [SUBJECT] = "subject",
+    [STATUS] = "status",
+    [DATE] = "date",
+    [ISBN_S] = "isbn",
+};
+
+const book_field_searcher get_by[EXPECTED_NUMBER_OF_FIELDS] = {
+    [TITLE] = get_idx_by_title,
+    [AUTHOR] = get_idx_by_author,
+    [CONTRIBUTOR] = get_idx_by_contributor,
+    [SUBJECT] = get_idx_by_subject,
+    [STATUS] = get_idx_by_status,
+    [DATE] = get_idx_by_date,
+    [ISBN_S] = get_idx_by_isbn_s,
+};
+
+const book_field_getter get_field[EXPECTED_NUMBER_OF_FIELDS] = {
+    [TITLE] = get_field_title,
+    [AUTHOR] = get_field_author,
+    [CONTRIBUTOR] = get_field_contributor,
+    [SUBJECT] = get_field_subject,
+    [STATUS] = get_field_status,
+    [DATE] = get_field_date,
+    [ISBN_S] = get_field_isbn_s
+};
+
+//------------------------------------------------------------------------------
+// primary functions - stuff that gets called directly in main()
+
+SorterError parse_args(int argc, char ** argv, SorterArgs * args) {
+    memset(args, 0, sizeof(SorterArgs));
+
+    for(int i = 1; i < argc; i++) {
+        char * arg = argv[i];
+
+        if(str_equal(arg, "--where")) {
+            if(i + 1 >= argc || args->num_where >= MAX_PREDICATES) return SORTER_ERR_USAGE;
+            args->where[args->num_where++] = argv[++i];
+        }
+        else if(str_equal(arg, "--report")) args->report = true;
+        else if(str_equal(arg, "--memory")) args->memory = true;
+        else if(str_equal(arg, "--order")) {
+            if(i + 1 >= argc) return SORTER_ERR_USAGE;
+            args->order = argv[++i];
+        }
+        else if(str_equal(arg, "--search")) {
+            if(i + 1 >= argc) return SORTER_ERR_USAGE;
+            args->search = argv[++i];
+        }
+        else if(str_equal(arg, "--serve")) {
+            if(i + 1 >= argc) return SORTER_ERR_USAGE;
+            args->serve = argv[++i];
+        }
+        else if(str_equal(arg, "--batch")) args->batch = true;
+        else if(str_equal(arg, "--site")) {
+            if(i + 1 >= argc) return SORTER_ERR_USAGE;
+            args->site = argv[++i];
+        }
+        else if(str_equal(arg, "--range")) {
+            // shelf numbers, from 1 and inclusive, like the ones in the output
+            unsigned int first, last;
+            char extra;
+            if(i + 1 >= argc || sscanf(argv[++i], "%u:%u%c", &first, &last, &extra) != 2 || first == 0 || last < first) return SORTER_ERR_USAGE;
+            args->range = true;
+            args->range_begin = first - 1;
+            args->range_end = last;
+        }
+        else if(strncmp(arg, "--", 2) == 0) return SORTER_ERR_USAGE; // unknown option
+        else if(args->input_filename == NULL) args->input_filename = arg;
+        else if(args->output_filename == NULL) args->output_filename = arg;
+        else return SORTER_ERR_USAGE;
+    }
+
+    if(args->input_filename == NULL) return SORTER_ERR_USAGE;
+    // a server answers --where, --search and the rest per request (WHERE, SEARCH, PAGE, RENDER), so they'd only be ignored
+    if(args->serve != NULL && (args->num_where > 0 || args->report || args->range || args->site != NULL || args->search != NULL)) return SORTER_ERR_USAGE;
+    // a batch writes one output per catalog, and nothing else
+    if(args->batch && (args->report || args->search != NULL || args->serve != NULL)) return SORTER_ERR_USAGE;
+    // a site is its own output
+    if(args->site != NULL && (args->output_filename != NULL || args->report || args->search != NULL || args->serve != NULL || args->batch || args->range)) return SORTER_ERR_USAGE;
+    // a range is a page of the whole shelf
+    if(args->range && (args->report || args->search != NULL || args->serve != NULL || args->batch || args->num_where > 0)) return SORTER_ERR_USAGE;
+
+    return SORTER_OK;
+}
+
+//----------------------------
+
+SorterError open_files(const SorterArgs * args, SorterFiles * files) {
+    files->input_file = fopen(args->input_filename, "r");
+    if(files->input_file == NULL) return SORTER_ERR_INPUT_FILE;
+
+    if(args->output_filename == NULL) {
+        // by default, OUTPUT_STDOUT
+        files->output_file = NULL;
+        files->output_format = OUTPUT_STDOUT;
+    } else {
+        files->output_file = fopen(args->output_filename, "w");
+        if(files->output_file == NULL) {
+            fclose(files->input_file);
+            return SORTER_ERR_OUTPUT_FILE;
+        }
+
+        files->output_format = output_format_for(args->output_filename);
+    }
+
+    return SORTER_OK;
+}
+
+OutputFormat output_format_for(const char * output_filename) {
+    size_t output_filename_len = strlen(output_filename);
+    const char * basename = strrchr(output_filename, '/'); // so "site/web.html" counts too
+    basename = (basename == NULL) ? output_filename : basename + 1;
+    // here i actually need strncmp for slicing strings
+    if((output_filename_len >= 5) && strncmp(".html", output_filename + (output_filename_len - 5), strlen(".html")) == 0) {
+        if(strncmp("web", basename, strlen("web")) == 0) return OUTPUT_WEBSITE;
+        return OUTPUT_HTML;
+    }
+    return OUTPUT_TXT;
+}
+
+//----------------------------
+
+// grows every plain column's offsets/lengths, every dictionary column's codes, and the order array together
+// columns that aren't being read yet stay empty; library_require_fields() sizes them when they are
+static SorterError grow_books(Library * library) {
+    unsigned int capacity = library->books_capacity * 2;
+
+    for(int field = 0; field < EXPECTED_NUMBER_OF_FIELDS; field++) {
+        StringColumn * column = &library->columns[field];
+        if(!column->materialized) continue;
+        if(column->is_dictionary) {
+            unsigned int * codes = sorter_realloc(library->allocator, column->codes, capacity * sizeof(unsigned int));
+            if(codes == NULL) return SORTER_ERR_OUT_OF_MEMORY;
+            column->codes = codes;
+        } else {
+            unsigned int * offsets = sorter_realloc(library->allocator, column->offsets, capacity * sizeof(unsigned int));
+            if(offsets == NULL) return SORTER_ERR_OUT_OF_MEMORY;
+            column->offsets = offsets;
+            unsigned int * lengths = sorter_realloc(library->allocator, column->lengths, capacity * sizeof(unsigned int));
+            if(lengths == NULL) return SORTER_ERR_OUT_OF_MEMORY;
+            column->lengths = lengths;
+            column->values_capacity = capacity;
+        }
+    }
+
+    unsigned int * order = sorter_realloc(library->allocator, library->order, capacity * sizeof(unsigned int));
+    if(order == NULL) return SORTER_ERR_OUT_OF_MEMORY;
+    library->order = order;
+
+    library->books_capacity = capacity;
+    return SORTER_OK;
+}
+
+static SorterError finish_dictionaries(Library * library, unsigned int fields);
+static SorterError append_values(Library * library, unsigned int row, const char * const * values, const unsigned int * lengths, unsigned int fields);
+
+// fills in acquired[]; dates are dictionary encoded, so each distinct date only gets parsed once
+static SorterError parse_dates(Library * library) {
+    const StringColumn * dates = &library->columns[DATE];
+
+    library->acquired = sorter_malloc(library->allocator, (library->num_books + 1) * sizeof(int));
+    int * value_dates = sorter_malloc(library->allocator, (dates->num_values + 1) * sizeof(int));
+    if(library->acquired == NULL || value_dates == NULL) {
+        sorter_free(library->allocator, value_dates);
+        return SORTER_ERR_OUT_OF_MEMORY;
+    }
+
+    for(unsigned int v = 0; v < dates->num_values; v++) value_dates[v] = parse_date(dates->blob + dates->offsets[v]);
+    for(unsigned int row = 0; row < library->num_books; row++) library->acquired[row] = value_dates[dates->codes[row]];
+
+    sorter_free(library->allocator, value_dates);
+    return SORTER_OK;
+}
+
+// the whole input file in one buffer, so the scanner can look at it a block at a time
+static SorterError read_input(const SorterAllocator * allocator, FILE * input_file, char ** data, size_t * size) {
+    size_t capacity = 1 << 16;
+    size_t len = 0;
+    char * buffer = sorter_malloc(allocator, capacity);
+    if(buffer == NULL) return SORTER_ERR_OUT_OF_MEMORY;
+
+    size_t got;
+    while((got = fread(buffer + len, 1, capacity - len, input_file)) > 0) {
+        len += got;
+        if(len == capacity) {
+            char * bigger = sorter_realloc(allocator, buffer, capacity * 2);
+            if(bigger == NULL) {
+                sorter_free(allocator, buffer);
+                return SORTER_ERR_OUT_OF_MEMORY;
+            }
+            buffer = bigger;
+            capacity *= 2;
+        }
+    }
+
+    *data = buffer;
+    *size = len;
+    return SORTER_OK;
+}
+
+// the names a column can go by in the header, besides its FIELD_NAMES one; matched ignoring case
+// the first of each is what Excel calls it (see EXPECTED_HEADER)
+static const char * const FIELD_HEADERS[EXPECTED_NUMBER_OF_FIELDS][4] = {
+    [TITLE] = { "TITLE", "TITLES" },
+    [AUTHOR] = { "AUTHOR(s)", "AUTHORS" },
+    [CONTRIBUTOR] = { "TRANSLATOR(s), EDITOR(s), etc.", "CONTRIBUTORS", "TRANSLATOR(s)", "EDITOR(s)" },
+    [SUBJECT] = { "SUBJECT", "SUBJECTS" },
+    [STATUS] = { "STATUS" },
+    [DATE] = { "DATE", "DATE ACQUIRED", "ACQUIRED" },
+    [ISBN_S] = { "ISBN", "ISBN(s)", "ISBNS" },
+};
+
+static bool header_names_field(const char * name, BookField field) {
+    if(str_equal_nocase(name, FIELD_NAMES[field])) return true;
+    for(int i = 0; i < 4 && FIELD_HEADERS[field][i] != NULL; i++) {
+        if(str_equal_nocase(name, FIELD_HEADERS[field][i])) return true;
+    }
+    return false;
+}
+
+// which column is which; a field named twice comes from its first column
+// anything but a title and an author can be missing, and is then empty for every book
+static SorterError map_header(const Record * header, ColumnSchema * schema) {
+    for(int field = 0; field < EXPECTED_NUMBER_OF_FIELDS; field++) schema->file_columns[field] = -1;
+
+    for(unsigned int i = 0; i < header->num_fields; i++) {
+        // Excel keeps whatever spaces were typed around a header, so ignore those
+        char name[MAX_LINE_LENGTH];
+        const char * value = header->values[i];
+        while(*value == ' ') value++;
+        size_t len = strlen(value);
+        while(len > 0 && value[len - 1] == ' ') len--;
+        memcpy(name, value, len);
+        name[len] = '\0';
+
+        for(int field = 0; field < EXPECTED_NUMBER_OF_FIELDS; field++) {
+            if(schema->file_columns[field] < 0 && header_names_field(name, (BookField) field)) {
+                schema->file_columns[field] = (int) i;
+                break;
+            }
+        }
+    }
+
+    if(schema->file_columns[TITLE] < 0 || schema->file_columns[AUTHOR] < 0) return SORTER_ERR_HEADER;
+    return SORTER_OK;
+}
+
+// the columns of the file that hold any of fields, as a scan_records() mask
+// the first column is always read, so every pass agrees on which lines are blank
+static unsigned long long file_column_mask(const ColumnSchema * schema, unsigned int fields) {
+    unsigned long long mask = 1;
+    for(int field = 0; field < EXPECTED_NUMBER_OF_FIELDS; field++) {
+        if((fields & FIELD_BIT(field)) && schema->file_columns[field] >= 0) mask |= 1ULL << schema->file_columns[field];
+    }
+    return mask;
+}
+
+static unsigned int materialized_fields(const Library * library) {
+    unsigned int fields = 0;
+    for(int field = 0; field < EXPECTED_NUMBER_OF_FIELDS; field++) {
+        if(library->columns[field].materialized) fields |= FIELD_BIT(field);
+    }
+    return fields;
+}
+
+// the input is read once for the first fields and again for each later batch of them;
+// every pass sees the same records, so row numbers line up
+typedef struct {
+    Library * library;
+    unsigned int fields;        // being read this pass
+    bool first_pass;            // rows are being added, rather than filled in
+    bool seen_header;
+    unsigned int row;
+    unsigned long long file_mask;
+} ParseState;
+
+static SorterError add_record(void * _state, const Record * record) {
+    ParseState * state = (ParseState *) _state;
+    Library * library = state->library;
+
+    if(!state->seen_header) {
+        state->seen_header = true;
+        if(!state->first_pass) return SORTER_OK;
+
+        SorterError error = map_header(record, &library->schema);
+        state->file_mask = file_column_mask(&library->schema, state->fields);
+        return error;
+    }
+
+    if(record->num_fields == 1 && record->lengths[0] == 0) return SORTER_OK; // blank line
+
+    // by field rather than by column of the file
+    const char * values[EXPECTED_NUMBER_OF_FIELDS];
+    unsigned int lengths[EXPECTED_NUMBER_OF_FIELDS];
+    for(int field = 0; field < EXPECTED_NUMBER_OF_FIELDS; field++) {
+        int column = library->schema.file_columns[field];
+        bool present = (column >= 0) && ((unsigned int) column < record->num_fields);
+        values[field] = present ? record->values[column] : "";
+        lengths[field] = present ? record->lengths[column] : 0;
+    }
+
+    if(!state->first_pass) {
+        if(state->row >= library->num_books) return SORTER_OK; // can't happen; the input hasn't changed
+        return append_values(library, state->row++, values, lengths, state->fields);
+    }
+
+    if(library->num_books >= library->books_capacity) {
+        SorterError error = grow_books(library);
+        if(error != SORTER_OK) return error;
+    }
+    return append_book(library, values, lengths, EXPECTED_NUMBER_OF_FIELDS);
+}
+
+// back to not read, e.g. after a pass that failed half way
+static void drop_columns(Library * library, unsigned int fields) {
+    for(int field = 0; field < EXPECTED_NUMBER_OF_FIELDS; field++) {
+        if(!(fields & FIELD_BIT(field))) continue;
+
+        StringColumn * column = &library->columns[field];
+        sorter_free(library->allocator, column->blob);
+        sorter_free(library->allocator, column->offsets);
+        sorter_free(library->allocator, column->lengths);
+        sorter_free(library->allocator, column->codes);
+        sorter_free(library->allocator, column->hash_slots);
+        memset(column, 0, sizeof(StringColumn));
+        column->is_dictionary = FIELD_IS_DICTIONARY[field];
+    }
+    if(fields & FIELD_BIT(DATE)) {
+        sorter_free(library->allocator, library->acquired);
+        library->acquired = NULL;
+    }
+}
+
+// dictionaries get sorted and the dates parsed once a pass has filled the columns in
+static SorterError finish_columns(Library * library, unsigned int fields) {
+    SorterError error = finish_dictionaries(library, fields);
+    if(error == SORTER_OK && (fields & FIELD_BIT(DATE))) error = parse_dates(library);
+
+    // nothing left to read
+    if(error == SORTER_OK && materialized_fields(library) == ALL_FIELDS) library_release_source(library);
+    return error;
+}
+
+SorterError parse_library(FILE * input_file, const SorterAllocator * allocator, Library * library) {
+    return parse_library_fields(input_file, allocator, ALL_FIELDS, library);
+}
+
+SorterError parse_library_fields(FILE * input_file, const SorterAllocator * allocator, unsigned int fields, Library * library) {
+    memset(library, 0, sizeof(Library));
+    library->allocator = allocator;
+    library->books_capacity = 1; // grow_books() doubles this to 2 before the first book
+
+    fields |= FIELD_BIT(TITLE) | FIELD_BIT(AUTHOR); // output, collections and search all use these
+    for(int field = 0; field < EXPECTED_NUMBER_OF_FIELDS; field++) {
+        library->columns[field].is_dictionary = FIELD_IS_DICTIONARY[field];
+        library->columns[field].materialized = (fields & FIELD_BIT(field)) != 0;
+    }
+
+    char * data = NULL;
+    size_t size = 0;
+    SorterError error = read_input(allocator, input_file, &data, &size);
+    fclose(input_file);
+    library->source = data;
+    library->source_size = size;
+
+    // the header is read in full; after that only the columns being read get copied out
+    ParseState state = { .library = library, .fields = fields, .first_pass = true, .file_mask = ~0ULL };
+    unsigned int bad_line = 0;
+    if(error == SORTER_OK) {
+        library->schema.delimiter = detect_delimiter(data, size);
+        error = grow_books(library);
+    }
+    if(error == SORTER_OK) error = scan_records(allocator, data, size, library->schema.delimiter, &state.file_mask, &add_record, &state, &bad_line);
+    if(error == SORTER_OK && !state.seen_header) error = SORTER_ERR_HEADER; // empty file
+
+    if(error == SORTER_ERR_HEADER) {
+        // the first line as it was in the file, for comparing by eye
+        const char * end = memchr(data, '\n', size);
+        size_t len = (end == NULL) ? size : (size_t) (end - data) + 1;
+        if(len > MAX_LINE_LENGTH - 1) len = MAX_LINE_LENGTH - 1;
+        snprintf(library->error_detail, sizeof(library->error_detail), "Expected \"%s\" Found \"%.*s\"", EXPECTED_HEADER, (int) len, data);
+    }
+    else if(error == SORTER_ERR_BAD_INPUT) {
+        snprintf(library->error_detail, sizeof(library->error_detail), "the quoted field in the record on line %u never ends", bad_line);
+    }
+
+    if(error == SORTER_OK) error = finish_columns(library, fields);
+
+    if(error != SORTER_OK) {
+        char error_detail[sizeof(library->error_detail)]; // destroy_library() clears it
+        memcpy(error_detail, library->error_detail, sizeof(error_detail));
+        destroy_library(library);
+        memcpy(library->error_detail, error_detail, sizeof(error_detail));
+        return error;
+    }
+
+    // shelf order starts out as input order
+    for(unsigned int i = 0; i < library->num_books; i++) library->order[i] = i;
+
+    return SORTER_OK;
+}
+
+SorterError library_require_fields(Library * library, unsigned int fields) {
+    fields &= ~materialized_fields(library);
+    if(fields == 0) return SORTER_OK;
+    if(library->source == NULL) {
+        snprintf(library->error_detail, sizeof(library->error_detail), "the input was let go of before all of its columns were read");
+        return SORTER_ERR_BAD_INPUT;
+    }
+
+    SorterError error = SORTER_OK;
+    for(int field = 0; field < EXPECTED_NUMBER_OF_FIELDS && error == SORTER_OK; field++) {
+        if(!(fields & FIELD_BIT(field))) continue;
+
+        StringColumn * column = &library->columns[field];
+        column->materialized = true;
+        if(column->is_dictionary) {
+            column->codes = sorter_malloc(library->allocator, (library->books_capacity + 1) * sizeof(unsigned int));
+            if(column->codes == NULL) error = SORTER_ERR_OUT_OF_MEMORY;
+        }
+    }
+
+    ParseState state = { .library = library, .fields = fields, .first_pass = false, .file_mask = file_column_mask(&library->schema, fields) };
+    if(error == SORTER_OK) error = scan_records(library->allocator, library->source, library->source_size, library->schema.delimiter, &state.file_mask, &add_record, &state, NULL);
+    if(error == SORTER_OK) error = finish_columns(library, fields);
+
+    if(error != SORTER_OK) drop_columns(library, fields);
+    return error;
+}
+
+void library_release_source(Library * library) {
+    sorter_free(library->allocator, library->source);
+    library->source = NULL;
+    library->source_size = 0;
+}
+
+//----------------------------
+
+SorterError sort_by_author(Library * library) {
+    // sort alphabetically by author, then by title within each author
+    // one key covers both, so there's no need to find and re-sort each author's span afterwards
+    return sort_library(library, &DEFAULT_SHELF_ORDER);
+}
+
+//----------------------------
+
+SorterError add_collection(Library * library, unsigned int num_titles, ...) {
+    if(num_titles < 2) return SORTER_ERR_BAD_COLLECTION;
+
+    va_list args;               // if macros are my favorite feature then varargs are my second favorite
+    va_start(args, num_titles); // although python does these in an infinitely safer and way better way
+
+    Collection * coll = sorter_malloc(library->allocator, sizeof(Collection));
+    if(coll == NULL) {
+        va_end(args);
+        return SORTER_ERR_OUT_OF_MEMORY;
+    }
+    coll->titles = sorter_calloc(library->allocator, num_titles, sizeof(char *));
+    coll->num_titles = 0;
+
+    SorterError error = (coll->titles == NULL) ? SORTER_ERR_OUT_OF_MEMORY : SORTER_OK;
+    library->error_detail[0] = '\0';
+
+    for(unsigned int i = 0; (error == SORTER_OK) && (i < num_titles); i++) {
+        const char * title = va_arg(args, char *);
+
+        if(get_by[TITLE](library, title) == -1) {
+            // not there as typed; it's probably a typo, so see what it's closest to before giving up
+            const SearchIndex * search_index;
+            SearchResults results;
+            error = library_search_index(library, &search_index);
+            if(error == SORTER_OK) error = search_library(library, search_index, title, false, &results);
+            if(error != SORTER_OK) break;
+
+            if(results.num_matches == 0) {
+                snprintf(library->error_detail, sizeof(library->error_detail), "\"%s\" is not in the library", title);
+                error = SORTER_ERR_TITLE_NOT_FOUND;
+                break;
+            }
+
+            const char * closest = get_field_title(library, results.matches[0].position);
+            int percent = (int) (results.matches[0].score * 100.0f + 0.5f);
+            if(results.matches[0].score < SEARCH_ACCEPT_SCORE) {
+                snprintf(library->error_detail, sizeof(library->error_detail), "\"%s\" is not in the library; did you mean \"%s\" (%d%% similar)", title, closest, percent);
+                error = SORTER_ERR_TITLE_NOT_FOUND;
+                break;
+            }
+
+            // close enough; use the real title so apply_collections() finds it, and leave a note
+            snprintf(library->error_detail, sizeof(library->error_detail), "\"%s\" is not in the library, using \"%s\" (%d%% similar)", title, closest, percent);
+            title = closest;
+        }
+
+        coll->titles[i] = sorter_malloc(library->allocator, strlen(title) + 1);
+        if(coll->titles[i] == NULL) {
+            error = SORTER_ERR_OUT_OF_MEMORY;
+            break;
+        }
+        memcpy(coll->titles[i], title, strlen(title) + 1);
+        coll->num_titles++;
+    }
+
+    va_end(args);
+
+    if(error == SORTER_OK && library->num_collections >= library->collections_capacity) {
+        unsigned int capacity = (library->collections_capacity == 0) ? 2 : library->collections_capacity * 2;
+        Collection ** collections = sorter_realloc(library->allocator, library->collections, capacity * sizeof(Collection *));
+        if(collections == NULL) error = SORTER_ERR_OUT_OF_MEMORY;
+        else {
+            library->collections = collections;
+            library->collections_capacity = capacity;
+        }
+    }
+
+    if(error != SORTER_OK) {
+        for(unsigned int i = 0; i < coll->num_titles; i++) sorter_free(library->allocator, coll->titles[i]);
+        sorter_free(library->allocator, coll->titles);
+        sorter_free(library->allocator, coll);
+        return error;
+    }
+
+    library->collections[library->num_collections] = coll;
+    library->num_collections++;
+
+    return SORTER_OK;
+}
+
+//----------------------------
+
+// pulls every member of a collection up behind its first title, which is at order[first_title_idx]
+// the first title keeps its alphabetical spot within the author, the rest follow it in order,
+// then the author's remaining titles resume alphabetically
+// the author's span is looked for within order[begin .. end), which has to hold all of it
+static void apply_collection(Library * library, const Collection * c, unsigned int first_title_idx, unsigned int begin, unsigned int end) {
+    unsigned int * order = library->order;
+
+    // get author span; the library is sorted by author so it's contiguous
+    unsigned int author = library_code(library, AUTHOR, order[first_title_idx]);
+    unsigned int author_start_idx = first_title_idx;
+    while(author_start_idx > begin && library_code(library, AUTHOR, order[author_start_idx - 1]) == author) author_start_idx--;
+    unsigned int author_end_idx = first_title_idx + 1;
+    while(author_end_idx < end && library_code(library, AUTHOR, order[author_end_idx]) == author) author_end_idx++;
+    unsigned int span = author_end_idx - author_start_idx;
+
+    unsigned int * span_rows = order + author_start_idx;
+    unsigned int * stitched = sorter_malloc(library->allocator, span * sizeof(unsigned int));
+    if(stitched == NULL) return;
+
+    unsigned int stitched_idx = 0;
+    for(unsigned int j = 0; j < span; j++) {
+        const char * title = library_value(library, TITLE, span_rows[j]);
+        bool is_later_member = false;
+        for(unsigned int k = 1; k < c->num_titles; k++) { // k = 1 to skip first member of collection
+            if(str_equal_nocase(c->titles[k], title)) is_later_member = true;
+        }
+        if(is_later_member) continue; // these get placed behind the first member
+
+        stitched[stitched_idx++] = span_rows[j];
+
+        if(str_equal_nocase(c->titles[0], title)) {
+            for(unsigned int k = 1; k < c->num_titles; k++) {
+                for(unsigned int m = 0; m < span; m++) {
+                    if(str_equal_nocase(c->titles[k], library_value(library, TITLE, span_rows[m]))) {
+                        stitched[stitched_idx++] = span_rows[m];
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    // members by a different author aren't in the span; stitched_idx == span unless a title repeats
+    if(stitched_idx == span) memcpy(span_rows, stitched, span * sizeof(unsigned int));
+    sorter_free(library->allocator, stitched);
+}
+
+void apply_collections(Library * library) {
+    for(unsigned int i = 0; i < library->num_collections; i++) {
+        const Collection * c = library->collections[i];
+
+        int first_title_idx = get_by[TITLE](library, c->titles[0]);
+        if(first_title_idx < 0) continue;
+
+        apply_collection(library, c, (unsigned int) first_title_idx, 0, library->num_books);
+    }
+    library->shelf_version++;
+}
+
+//----------------------------
+
+void do_output(const Library * library, FILE * output_file, OutputFormat output_format) {
+    do_output_positions(library, NULL, library->num_books, output_file, output_format);
+}
+
+// rows are formatted in chunks of this many, each chunk into its own buffer on its own thread,
+// and the buffers written out in order; a round is one chunk per thread
+#define RENDER_CHUNK_SIZE 16384
+#define MAX_RENDER_THREADS 16
+
+// the longest a formatted row can get: a padded title, an author, and the html around them
+#define MAX_ROW_LENGTH (4 * MAX_LINE_LENGTH)
+
+typedef struct {
+    const Library * library;
+    const unsigned int * positions;
+    OutputFormat output_format;
+    int longest_title_length;
+    unsigned int begin;
+    unsigned int end;
+
+    char * buffer;
+    size_t buffer_size;
+    size_t buffer_capacity;
+    bool failed;                // out of memory; the chunk gets written straight to the file instead
+} RenderChunk;
+
+// one row, as do_output() writes it; returns its length
+static int format_row(const RenderChunk * chunk, unsigned int i, char * output_buf, size_t output_buf_size) {
+    const char * txt_format_str = "%3d: %-*s %s\n";
+    const char * html_format_str = "\t<tr>\n\t\t<td>%d</td>\n\t\t<td>%s</td>\n\t\t<td>%s</td>\n\t</tr>\n";
+    const char * website_format_str = "<tr><td>%s</td><td>%s</td></tr>";
+
+    const Library * library = chunk->library;
+    unsigned int position = (chunk->positions == NULL) ? i : chunk->positions[i];
+    const char * title = library_value(library, TITLE, library->order[position]);
+    const char * author = library_value(library, AUTHOR, library->order[position]);
+
+    switch(chunk->output_format) {
+        case OUTPUT_STDOUT:
+        case OUTPUT_TXT: return snprintf(output_buf, output_buf_size, txt_format_str, position + 1, chunk->longest_title_length, title, author);
+        case OUTPUT_HTML: return snprintf(output_buf, output_buf_size, html_format_str, position + 1, title, author);
+        case OUTPUT_WEBSITE: return snprintf(output_buf, output_buf_size, website_format_str, title, author);
+    }
+    return 0;
+}
+
+static void * render_chunk(void * _chunk) {
+    RenderChunk * chunk = (RenderChunk *) _chunk;
+    chunk->buffer_size = 0;
+    chunk->failed = false;
+
+    for(unsigned int i = chunk->begin; i < chunk->end; i++) {
+        if(chunk->buffer_capacity - chunk->buffer_size < MAX_ROW_LENGTH) {
+            // about 64 bytes a row to start with, so a short list doesn't get a buffer sized for a whole chunk
+            size_t capacity = (chunk->buffer_capacity == 0) ? (size_t) (chunk->end - chunk->begin) * 64 + MAX_ROW_LENGTH : chunk->buffer_capacity * 2;
+            char * buffer = sorter_realloc(chunk->library->allocator, chunk->buffer, capacity);
+            if(buffer == NULL) {
+                chunk->failed = true;
+                return NULL;
+            }
+            chunk->buffer = buffer;
+            chunk->buffer_capacity = capacity;
+        }
+
+        int len = format_row(chunk, i, chunk->buffer + chunk->buffer_size, chunk->buffer_capacity - chunk->buffer_size);
+        if(len > 0) chunk->buffer_size += len;
+    }
+
+    return NULL;
+}
+
+// positions are shelf positions (e.g. a query's matches); NULL means every book in shelf order
+// the row numbers printed are always shelf numbers, so a filtered list still tells you where to look
+// big outputs are formatted on several threads, but the bytes are the same as formatting them one by one
+void do_output_positions(const Library * library, const unsigned int * positions, unsigned int num_positions, FILE * output_file, OutputFormat output_format) {
+    const char * html_preamble = "<style>\n\tbody {\n\t\tcolor: white;\n\t\tbackground-color: #222;\n\t}\n</style>\n\n<table style=\"width: 100%;\">\n\t<tr>\n\t\t<th>NUMBER</th>\n\t\t<th>TITLE</th>\n\t\t<th>AUTHOR</th>\n\t</tr>\n";
+    const char * website_preamble = "<table style=\"width: 100%;\"><tr><th>TITLE</th><th>AUTHOR</th></tr> ";
+
+    if(output_format == OUTPUT_STDOUT) output_file = stdout;
+
+    const StringColumn * titles = &library->columns[TITLE];
+
+    int longest_title_length = 0;
+    for(unsigned int i = 0; i < num_positions; i++) {
+        unsigned int position = (positions == NULL) ? i : positions[i];
+        int len = (int) titles->lengths[library->order[position]]; // no strlen(), the column knows
+        if(len > longest_title_length) {
+            longest_title_length = len;
+        }
+    }
+
+    if(output_format == OUTPUT_HTML) fputs(html_preamble, output_file);
+    else if(output_format == OUTPUT_WEBSITE) fputs(website_preamble, output_file);
+
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int num_threads = num_positions / RENDER_CHUNK_SIZE + 1;
+    if(num_cpus > 0 && num_threads > (unsigned int) num_cpus) num_threads = (unsigned int) num_cpus;
+    if(num_threads > MAX_RENDER_THREADS) num_threads = MAX_RENDER_THREADS;
+
+    RenderChunk chunks[MAX_RENDER_THREADS];
+    pthread_t threads[MAX_RENDER_THREADS];
+    memset(chunks, 0, sizeof(chunks));
+    for(unsigned int c = 0; c < num_threads; c++) {
+        chunks[c].library = library;
+        chunks[c].positions = positions;
+        chunks[c].output_format = output_format;
+        chunks[c].longest_title_length = longest_title_length;
+    }
+
+    for(unsigned int round_begin = 0; round_begin < num_positions; round_begin += num_threads * RENDER_CHUNK_SIZE) {
+        bool started[MAX_RENDER_THREADS] = { false };
+
+        for(unsigned int c = 0; c < num_threads; c++) {
+            unsigned long long begin = round_begin + (unsigned long long) c * RENDER_CHUNK_SIZE;
+            chunks[c].begin = (begin < num_positions) ? (unsigned int) begin : num_positions;
+            chunks[c].end = (begin + RENDER_CHUNK_SIZE < num_positions) ? (unsigned int) (begin + RENDER_CHUNK_SIZE) : num_positions;
+
+            // the first chunk runs on this thread; if a thread won't start, its chunk does too
+            if(c > 0 && chunks[c].begin < chunks[c].end && pthread_create(&threads[c], NULL, &render_chunk, &chunks[c]) == 0) started[c] = true;
+        }
+        render_chunk(&chunks[0]);
+
+        for(unsigned int c = 0; c < num_threads; c++) {
+            if(started[c]) pthread_join(threads[c], NULL);
+            else if(c > 0) render_chunk(&chunks[c]);
+
+            if(!chunks[c].failed) fwrite(chunks[c].buffer, 1, chunks[c].buffer_size, output_file);
+            else {
+                // no memory for a buffer, so one row at a time
+                char row[MAX_ROW_LENGTH];
+                for(unsigned int i = chunks[c].begin; i < chunks[c].end; i++) {
+                    int len = format_row(&chunks[c], i, row, sizeof(row));
+                    if(len > 0) fwrite(row, 1, len, output_file);
+                }
+            }
+        }
+    }
+
+    for(unsigned int c = 0; c < num_threads; c++) sorter_free(library->allocator, chunks[c].buffer);
+}
+
+//----------------------------
+
+void destroy_library(Library * library) {
+    const SorterAllocator * allocator = library->allocator;
+
+    // free collections
+    for(unsigned int i = 0; i < library->num_collections; i++) {
+        for(unsigned int j = 0; j < library->collections[i]->num_titles; j++) {
+            sorter_free(allocator, library->collections[i]->titles[j]);
+        }
+        sorter_free(allocator, library->collections[i]->titles);
+        sorter_free(allocator, library->collections[i]);
+    }
+    sorter_free(allocator, library->collections);
+
+    // free columns
+    for(int field = 0; field < EXPECTED_NUMBER_OF_FIELDS; field++) {
+        sorter_free(allocator, library->columns[field].blob);
+        sorter_free(allocator, library->columns[field].offsets);
+        sorter_free(allocator, library->columns[field].lengths);
+        sorter_free(allocator, library->columns[field].codes);
+        sorter_free(allocator, library->columns[field].hash_slots);
+    }
+    sorter_free(allocator, library->order);
+    sorter_free(allocator, library->acquired);
+    sorter_free(allocator, library->source);
+
+    if(library->search_index != NULL) {
+        destroy_search_index(library->search_index);
+        sorter_free(allocator, library->search_index);
+    }
+
+    memset(library, 0, sizeof(Library));
+}
+
+//------------------------------------------------------------------------------
+// secondary functions - not directly called by main()
+
+int alphabetic_priority_c(char a, char b);
+
+// appends one value to the end of a column's blob, returning its index through value_idx
+static SorterError column_append(const SorterAllocator * allocator, StringColumn * column, const char * value, size_t len, unsigned int * value_idx) {
+    if(column->num_values >= column->values_capacity) {
+        unsigned int capacity = (column->values_capacity == 0) ? 2 : column->values_capacity * 2;
+        unsigned int * offsets = sorter_realloc(allocator, column->offsets, capacity * sizeof(unsigned int));
+        if(offsets == NULL) return SORTER_ERR_OUT_OF_MEMORY;
+        column->offsets = offsets;
+        unsigned int * lengths = sorter_realloc(allocator, column->lengths, capacity * sizeof(unsigned int));
+        if(lengths == NULL) return SORTER_ERR_OUT_OF_MEMORY;
+        column->lengths = lengths;
+        column->values_capacity = capacity;
+    }
+
+    if(column->blob_size + len + 1 > column->blob_capacity) {
+        size_t capacity = (column->blob_capacity == 0) ? 256 : column->blob_capacity;
+        while(column->blob_size + len + 1 > capacity) capacity *= 2;
+        char * blob = sorter_realloc(allocator, column->blob, capacity);
+        if(blob == NULL) return SORTER_ERR_OUT_OF_MEMORY;
+        column->blob = blob;
+        column->blob_capacity = capacity;
+    }
+
+    memcpy(column->blob + column->blob_size, value, len);
+    column->blob[column->blob_size + len] = '\0';
+    column->offsets[column->num_values] = (unsigned int) column->blob_size;
+    column->lengths[column->num_values] = (unsigned int) len;
+    column->blob_size += len + 1;
+    *value_idx = column->num_values++;
+
+    return SORTER_OK;
+}
+
+// FNV-1a; only used for interning, so it doesn't need to be anything fancy
+static unsigned int hash_string(const char * value, size_t len) {
+    unsigned int hash = 2166136261u;
+    for(size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) value[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// finds value in a dictionary column, adding it if it's new
+// hash_slots holds value index + 1, so 0 means empty
+static SorterError column_intern(const SorterAllocator * allocator, StringColumn * column, const char * value, size_t len, unsigned int * code) {
+    if((column->num_values + 1) * 2 > column->hash_capacity) { // keep the table at most half full
+        unsigned int capacity = (column->hash_capacity == 0) ? 64 : column->hash_capacity * 2;
+        unsigned int * slots = sorter_calloc(allocator, capacity, sizeof(unsigned int));
+        if(slots == NULL) return SORTER_ERR_OUT_OF_MEMORY;
+
+        for(unsigned int i = 0; i < column->num_values; i++) {
+            unsigned int slot = hash_string(column->blob + column->offsets[i], column->lengths[i]) & (capacity - 1);
+            while(slots[slot] != 0) slot = (slot + 1) & (capacity - 1);
+            slots[slot] = i + 1;
+        }
+
+        sorter_free(allocator, column->hash_slots);
+        column->hash_slots = slots;
+        column->hash_capacity = capacity;
+    }
+
+    unsigned int slot = hash_string(value, len) & (column->hash_capacity - 1);
+    while(column->hash_slots[slot] != 0) {
+        unsigned int i = column->hash_slots[slot] - 1;
+        if(column->lengths[i] == len && memcmp(column->blob + column->offsets[i], value, len) == 0) {
+            *code = i;
+            return SORTER_OK;
+        }
+        slot = (slot + 1) & (column->hash_capacity - 1);
+    }
+
+    SorterError error = column_append(allocator, column, value, len, code);
+    if(error == SORTER_OK) column->hash_slots[slot] = *code + 1;
+    return error;
+}
+
+// collation order for dictionary values, same as alphabetic_priority_s() with the raw bytes as tiebreak
+static int dictionary_priority(const void * _column, unsigned int a, unsigned int b) {
+    const StringColumn * column = (const StringColumn *) _column;
+    const char * value_a = column->blob + column->offsets[a];
+    const char * value_b = column->blob + column->offsets[b];
+
+    int cmp = alphabetic_priority_s(value_a, value_b);
+    if(cmp == 0) cmp = strcmp(value_a, value_b);
+    return cmp;
+}
+
+// dates sort chronologically; anything parse_date() can't read goes first
+static int date_priority(const void * _column, unsigned int a, unsigned int b) {
+    const StringColumn * column = (const StringColumn *) _column;
+    const char * value_a = column->blob + column->offsets[a];
+    const char * value_b = column->blob + column->offsets[b];
+
+    int date_a = parse_date(value_a);
+    int date_b = parse_date(value_b);
+    if(date_a != date_b) return (date_a > date_b) - (date_a < date_b);
+    return strcmp(value_a, value_b);
+}
+
+// once everything is interned: sort each dictionary by collation and renumber the rows' codes to match,
+// so comparing two codes is the same as comparing the two strings
+static SorterError finish_dictionaries(Library * library, unsigned int fields) {
+    for(int field = 0; field < EXPECTED_NUMBER_OF_FIELDS; field++) {
+        StringColumn * column = &library->columns[field];
+        if(!column->is_dictionary || !(fields & FIELD_BIT(field))) continue;
+
+        sorter_free(library->allocator, column->hash_slots);
+        column->hash_slots = NULL;
+        column->hash_capacity = 0;
+
+        unsigned int num_values = column->num_values;
+        if(num_values == 0) continue;
+
+        unsigned int * sorted = sorter_malloc(library->allocator, num_values * sizeof(unsigned int));
+        unsigned int * rank = sorter_malloc(library->allocator, num_values * sizeof(unsigned int));
+        unsigned int * offsets = sorter_malloc(library->allocator, num_values * sizeof(unsigned int));
+        unsigned int * lengths = sorter_malloc(library->allocator, num_values * sizeof(unsigned int));
+        char * blob = sorter_malloc(library->allocator, column->blob_size);
+        if(sorted == NULL || rank == NULL || offsets == NULL || lengths == NULL || blob == NULL) {
+            sorter_free(library->allocator, sorted);
+            sorter_free(library->allocator, rank);
+            sorter_free(library->allocator, offsets);
+            sorter_free(library->allocator, lengths);
+            sorter_free(library->allocator, blob);
+            return SORTER_ERR_OUT_OF_MEMORY;
+        }
+
+        for(unsigned int i = 0; i < num_values; i++) sorted[i] = i;
+        sort_rows(library->allocator, column, sorted, num_values, (field == DATE) ? &date_priority : &dictionary_priority);
+
+        // rewrite the blob in sorted order too, so neighbouring codes are neighbours in memory
+        size_t blob_size = 0;
+        for(unsigned int i = 0; i < num_values; i++) {
+            unsigned int old = sorted[i];
+            rank[old] = i;
+            memcpy(blob + blob_size, column->blob + column->offsets[old], column->lengths[old] + 1);
+            offsets[i] = (unsigned int) blob_size;
+            lengths[i] = column->lengths[old];
+            blob_size += column->lengths[old] + 1;
+        }
+
+        for(unsigned int row = 0; row < library->num_books; row++) column->codes[row] = rank[column->codes[row]];
+
+        sorter_free(library->allocator, column->blob);
+        sorter_free(library->allocator, column->offsets);
+        sorter_free(library->allocator, column->lengths);
+        column->blob = blob;
+        column->blob_capacity = column->blob_size;
+        column->offsets = offsets;
+        column->lengths = lengths;
+        column->values_capacity = num_values;
+
+        sorter_free(library->allocator, sorted);
+        sorter_free(library->allocator, rank);
+    }
+
+    return SORTER_OK;
+}
+
+// one book's values for the columns in fields, in BookField order
+// dictionary columns are filled in at row, plain ones appended, so rows have to come in order
+static SorterError append_values(Library * library, unsigned int row, const char * const * values, const unsigned int * lengths, unsigned int fields) {
+    for(unsigned int field = 0; field < EXPECTED_NUMBER_OF_FIELDS; field++) {
+        if(!(fields & FIELD_BIT(field))) continue;
+
+        StringColumn * column = &library->columns[field];
+        unsigned int value_idx; // plain columns: value index == row
+        SorterError error;
+        if(column->is_dictionary) error = column_intern(library->allocator, column, values[field], lengths[field], &column->codes[row]);
+        else error = column_append(library->allocator, column, values[field], lengths[field], &value_idx);
+        if(error != SORTER_OK) return error;
+    }
+    return SORTER_OK;
+}
+
+// append one record of the input file as a new row, to every column that has been read so far
+// values come in BookField order; missing values are left empty and extra ones are ignored
+// the caller makes sure there's room for one more row
+SorterError append_book(Library * library, const char * const * values, const unsigned int * lengths, unsigned int num_values) {
+    const char * all_values[EXPECTED_NUMBER_OF_FIELDS];
+    unsigned int all_lengths[EXPECTED_NUMBER_OF_FIELDS];
+    for(unsigned int field = 0; field < EXPECTED_NUMBER_OF_FIELDS; field++) {
+        all_values[field] = (field < num_values) ? values[field] : "";
+        all_lengths[field] = (field < num_values) ? lengths[field] : 0;
+    }
+
+    SorterError error = append_values(library, library->num_books, all_values, all_lengths, materialized_fields(library));
+    if(error != SORTER_OK) return error;
+
+    library->num_books++;
+    return SORTER_OK;
+}
+
+//----------------------------
+// sorting
+
+// stable natural merge sort of row numbers; this takes a context pointer, which qsort() can't
+// the spreadsheet is usually in shelf order already apart from a few new books at the bottom, so
+// rather than splitting blindly this looks for the runs that are already sorted and merges those:
+// sorted input is one pass of compares, and a few appended books cost one run and one merge
+
+// runs shorter than this are topped up with insertion sort before merging
+#define MIN_RUN 32
+
+static void insertion_sort_rows(const void * context, unsigned int * rows, unsigned int num_rows, row_comparator compare) {
+    for(unsigned int i = 1; i < num_rows; i++) {
+        unsigned int row = rows[i];
+        unsigned int j = i;
+        while(j > 0 && compare(context, rows[j - 1], row) > 0) {
+            rows[j] = rows[j - 1];
+            j--;
+        }
+        rows[j] = row;
+    }
+}
+
+// length of the run starting at rows[0], made ascending if it wasn't
+static unsigned int find_run(const void * context, unsigned int * rows, unsigned int num_rows, row_comparator compare) {
+    if(num_rows < 2) return num_rows;
+
+    unsigned int len = 2;
+    if(compare(context, rows[1], rows[0]) < 0) {
+        // strictly descending only, so reversing it can't swap two equal rows
+        while(len < num_rows && compare(context, rows[len], rows[len - 1]) < 0) len++;
+        for(unsigned int i = 0, j = len - 1; i < j; i++, j--) {
+            unsigned int row = rows[i];
+            rows[i] = rows[j];
+            rows[j] = row;
+        }
+    }
+    else while(len < num_rows && compare(context, rows[len], rows[len - 1]) >= 0) len++;
+
+    return len;
+}
+
+// first i with rows[i] > row, or with rows[i] >= row if !after_equal
+static unsigned int search_rows(const void * context, const unsigned int * rows, unsigned int num_rows, unsigned int row, bool after_equal, row_comparator compare) {
+    unsigned int low = 0, high = num_rows;
+    while(low < high) {
+        unsigned int mid = low + (high - low) / 2;
+        int cmp = compare(context, rows[mid], row);
+        if(cmp < 0 || (after_equal && cmp == 0)) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+// merges the neighbouring runs rows[0 .. left_len) and rows[left_len .. left_len + right_len)
+// only the smaller side is copied out, so scratch needs half the rows at most
+static void merge_runs(const void * context, unsigned int * rows, unsigned int left_len, unsigned int right_len, unsigned int * scratch, row_comparator compare) {
+    unsigned int * left = rows;
+    unsigned int * right = rows + left_len;
+    if(compare(context, left[left_len - 1], right[0]) <= 0) return; // already in order
+
+    // whatever's at the start of left or the end of right is already where it belongs
+    unsigned int skip = search_rows(context, left, left_len, right[0], true, compare);
+    left += skip;
+    left_len -= skip;
+    right_len = search_rows(context, right, right_len, left[left_len - 1], false, compare);
+
+    if(left_len <= right_len) {
+        // front to back, out of a copy of left
+        memcpy(scratch, left, left_len * sizeof(unsigned int));
+        unsigned int a = 0, b = 0, out = 0;
+        while(a < left_len && b < right_len) {
+            if(compare(context, right[b], scratch[a]) < 0) left[out++] = right[b++];
+            else left[out++] = scratch[a++];
+        }
+        memcpy(left + out, scratch + a, (left_len - a) * sizeof(unsigned int));
+    }
+    else {
+        // back to front, out of a copy of right
+        memcpy(scratch, right, right_len * sizeof(unsigned int));
+        unsigned int a = left_len, b = right_len, out = left_len + right_len;
+        while(a > 0 && b > 0) {
+            if(compare(context, scratch[b - 1], left[a - 1]) < 0) left[--out] = left[--a];
+            else left[--out] = scratch[--b];
+        }
+        memcpy(left, scratch, b * sizeof(unsigned int));
+    }
+}
+
+void sort_rows(const SorterAllocator * allocator, const void * context, unsigned int * rows, unsigned int num_rows, row_comparator compare) {
+    if(num_rows < 2) return;
+
+    // every run but the last is at least MIN_RUN long, so this many starts is plenty
+    unsigned int * run_starts = sorter_malloc(allocator, (num_rows / MIN_RUN + 2) * sizeof(unsigned int));
+    unsigned int * scratch = sorter_malloc(allocator, (num_rows / 2 + 1) * sizeof(unsigned int));
+    if(run_starts == NULL || scratch == NULL) {
+        // slow, but it doesn't need memory
+        sorter_free(allocator, run_starts);
+        sorter_free(allocator, scratch);
+        insertion_sort_rows(context, rows, num_rows, compare);
+        return;
+    }
+
+    unsigned int num_runs = 0;
+    for(unsigned int start = 0; start < num_rows; ) {
+        unsigned int len = find_run(context, rows + start, num_rows - start, compare);
+        if(len < MIN_RUN) {
+            len = (num_rows - start < MIN_RUN) ? num_rows - start : MIN_RUN;
+            insertion_sort_rows(context, rows + start, len, compare); // the start of it is sorted already, so this is cheap
+        }
+        run_starts[num_runs++] = start;
+        start += len;
+    }
+    run_starts[num_runs] = num_rows;
+
+    // merge neighbouring pairs of runs until there's one left
+    while(num_runs > 1) {
+        unsigned int merged = 0;
+        unsigned int r = 0;
+        for(; r + 1 < num_runs; r += 2) {
+            merge_runs(context, rows + run_starts[r], run_starts[r + 1] - run_starts[r], run_starts[r + 2] - run_starts[r + 1], scratch, compare);
+            run_starts[merged++] = run_starts[r];
+        }
+        if(r < num_runs) run_starts[merged++] = run_starts[r];
+        run_starts[merged] = num_rows;
+        num_runs = merged;
+    }
+
+    sorter_free(allocator, run_starts);
+    sorter_free(allocator, scratch);
+}
+
+static void swap_rows(unsigned int * rows, unsigned int a, unsigned int b) {
+    unsigned int row = rows[a];
+    rows[a] = rows[b];
+    rows[b] = row;
+}
+
+// quickselect: moves the k-th smallest row to rows[k], with everything before it smaller and everything after it bigger
+// rows that compare equal can land either side of k, so give it a comparator that never returns 0 if that matters
+// pivots are the median of three, which is fine for input that is mostly sorted already; if it still isn't
+// getting anywhere after a couple of passes per bit of num_rows, whatever is left is just sorted
+void select_rows(const SorterAllocator * allocator, const void * context, unsigned int * rows, unsigned int num_rows, unsigned int k, row_comparator compare) {
+    if(k >= num_rows) return;
+
+    unsigned int budget = 0;
+    for(unsigned int n = num_rows; n > 0; n >>= 1) budget += 2;
+
+    unsigned int lo = 0;
+    unsigned int hi = num_rows; // k is somewhere in rows[lo .. hi)
+    while(hi - lo > MIN_RUN) {
+        if(budget-- == 0) {
+            sort_rows(allocator, context, rows + lo, hi - lo, compare);
+            return;
+        }
+
+        // the median of the first, middle and last rows goes to the end, as the pivot
+        unsigned int mid = lo + (hi - lo) / 2;
+        unsigned int last = hi - 1;
+        if(compare(context, rows[mid], rows[lo]) < 0) swap_rows(rows, mid, lo);
+        if(compare(context, rows[last], rows[lo]) < 0) swap_rows(rows, last, lo);
+        if(compare(context, rows[mid], rows[last]) < 0) swap_rows(rows, mid, last);
+
+        unsigned int pivot = rows[last];
+        unsigned int store = lo;
+        for(unsigned int i = lo; i < last; i++) {
+            if(compare(context, rows[i], pivot) < 0) swap_rows(rows, i, store++);
+        }
+        swap_rows(rows, store, last);
+
+        if(k == store) return;
+        if(k < store) hi = store;
+        else lo = store + 1;
+    }
+
+    insertion_sort_rows(context, rows + lo, hi - lo, compare);
+}
+
+//----------------------------
+// shelf orders, compiled into sort keys
+
+const ShelfOrder DEFAULT_SHELF_ORDER = {
+    .keys = { { AUTHOR, false }, { TITLE, false } },
+    .num_keys = 2,
+};
+
+SorterError parse_shelf_order(const char * spec, ShelfOrder * order) {
+    memset(order, 0, sizeof(ShelfOrder));
+
+    const char * cursor = spec;
+    for(;;) {
+        while(*cursor == ' ') cursor++;
+
+        bool descending = false;
+        if(*cursor == '-' || *cursor == '+') descending = (*(cursor++) == '-');
+
+        const char * name = cursor;
+        while(*cursor != ',' && *cursor != ' ' && *cursor != '\0') cursor++;
+        size_t name_len = cursor - name;
+        while(*cursor == ' ') cursor++;
+
+        BookField field;
+        if(!parse_field_name(name, name_len, &field)) {
+            snprintf(order->error_detail, sizeof(order->error_detail), "\"%.*s\" is not a field", (int) name_len, name);
+            return SORTER_ERR_BAD_ORDER;
+        }
+        for(unsigned int i = 0; i < order->num_keys; i++) {
+            if(order->keys[i].field == field) {
+                snprintf(order->error_detail, sizeof(order->error_detail), "\"%s\" is in there twice", FIELD_NAMES[field]);
+                return SORTER_ERR_BAD_ORDER;
+            }
+        }
+
+        order->keys[order->num_keys].field = field;
+        order->keys[order->num_keys].descending = descending;
+        order->num_keys++;
+
+        if(*cursor == '\0') break;
+        if(*cursor != ',') {
+            snprintf(order->error_detail, sizeof(order->error_detail), "expected a comma before \"%s\"", cursor);
+            return SORTER_ERR_BAD_ORDER;
+        }
+        cursor++;
+    }
+
+    return SORTER_OK;
+}
+
+bool order_keeps_authors_together(const ShelfOrder * order) {
+    return (order->num_keys > 0) && (order->keys[0].field == AUTHOR);
+}
+
+unsigned int shelf_order_fields(const ShelfOrder * order) {
+    unsigned int fields = 0;
+    for(unsigned int i = 0; i < order->num_keys; i++) fields |= FIELD_BIT(order->keys[i].field);
+    return fields;
+}
+
+static SorterError key_reserve(SortKeys * keys, size_t len) {
+    if(keys->blob_size + len <= keys->blob_capacity) return SORTER_OK;
+
+    size_t capacity = (keys->blob_capacity == 0) ? 4096 : keys->blob_capacity;
+    while(keys->blob_size + len > capacity) capacity *= 2;
+    unsigned char * blob = sorter_realloc(keys->allocator, keys->blob, capacity);
+    if(blob == NULL) return SORTER_ERR_OUT_OF_MEMORY;
+    keys->blob = blob;
+    keys->blob_capacity = capacity;
+    return SORTER_OK;
+}
+
+// how each field becomes bytes:
+//   dictionary fields: the code, 4 bytes big endian; codes are already in collation (or date) order
+//   plain fields: the sanitize_title() form, a 0, then the raw value and another 0, so that
+//                 values that sanitize the same still land in a fixed order
+// descending fields have every byte flipped; codes are fixed width, and text (UTF-8 or plain ASCII)
+// never holds a 0xff, so a flipped terminator still sorts after any flipped character and shorter values come last
+SorterError build_sort_keys(const Library * library, const ShelfOrder * order, SortKeys * keys) {
+    memset(keys, 0, sizeof(SortKeys));
+    keys->allocator = library->allocator;
+
+    unsigned int num_books = library->num_books;
+    keys->offsets = sorter_malloc(keys->allocator, (num_books + 1) * sizeof(unsigned int));
+    keys->lengths = sorter_malloc(keys->allocator, (num_books + 1) * sizeof(unsigned int));
+    keys->prefixes = sorter_malloc(keys->allocator, (num_books + 1) * sizeof(unsigned long long));
+    if(keys->offsets == NULL || keys->lengths == NULL || keys->prefixes == NULL) {
+        destroy_sort_keys(keys);
+        return SORTER_ERR_OUT_OF_MEMORY;
+    }
+
+    char sanitized[MAX_LINE_LENGTH];
+
+    for(unsigned int row = 0; row < num_books; row++) {
+        size_t start = keys->blob_size;
+
+        for(unsigned int k = 0; k < order->num_keys; k++) {
+            BookField field = order->keys[k].field;
+            const StringColumn * column = &library->columns[field];
+            size_t key_start = keys->blob_size;
+
+            if(column->is_dictionary) {
+                if(key_reserve(keys, 4) != SORTER_OK) goto fail;
+                unsigned int code = column->codes[row];
+                keys->blob[keys->blob_size++] = (unsigned char) (code >> 24);
+                keys->blob[keys->blob_size++] = (unsigned char) (code >> 16);
+                keys->blob[keys->blob_size++] = (unsigned char) (code >> 8);
+                keys->blob[keys->blob_size++] = (unsigned char) code;
+            } else {
+                const char * value = column->blob + column->offsets[row];
+                size_t value_len = column->lengths[row];
+                sanitize_title(value, sanitized, sizeof(sanitized));
+                size_t sanitized_len = strlen(sanitized);
+
+                if(key_reserve(keys, sanitized_len + value_len + 2) != SORTER_OK) goto fail;
+                memcpy(keys->blob + keys->blob_size, sanitized, sanitized_len);
+                keys->blob_size += sanitized_len;
+                keys->blob[keys->blob_size++] = 0;
+                memcpy(keys->blob + keys->blob_size, value, value_len);
+                keys->blob_size += value_len;
+                keys->blob[keys->blob_size++] = 0;
+            }
+
+            if(order->keys[k].descending) {
+                for(size_t i = key_start; i < keys->blob_size; i++) keys->blob[i] = ~keys->blob[i];
+            }
+        }
+
+        keys->offsets[row] = (unsigned int) start;
+        keys->lengths[row] = (unsigned int) (keys->blob_size - start);
+
+        unsigned long long prefix = 0;
+        for(unsigned int i = 0; i < 8; i++) {
+            prefix <<= 8;
+            if(i < keys->lengths[row]) prefix |= keys->blob[start + i];
+        }
+        keys->prefixes[row] = prefix;
+    }
+
+    return SORTER_OK;
+
+fail:
+    destroy_sort_keys(keys);
+    return SORTER_ERR_OUT_OF_MEMORY;
+}
+
+int compare_sort_keys(const void * _keys, unsigned int row_a, unsigned int row_b) {
+    const SortKeys * keys = (const SortKeys *) _keys;
+
+    unsigned long long prefix_a = keys->prefixes[row_a];
+    unsigned long long prefix_b = keys->prefixes[row_b];
+    if(prefix_a != prefix_b) return (prefix_a > prefix_b) ? 1 : -1;
+
+    unsigned int len_a = keys->lengths[row_a];
+    unsigned int len_b = keys->lengths[row_b];
+    int cmp = memcmp(keys->blob + keys->offsets[row_a], keys->blob + keys->offsets[row_b], (len_a < len_b) ? len_a : len_b);
+    if(cmp != 0) return cmp;
+    return (len_a > len_b) - (len_a < len_b);
+}
+
+void destroy_sort_keys(SortKeys * keys) {
+    sorter_free(keys->allocator, keys->blob);
+    sorter_free(keys->allocator, keys->offsets);
+    sorter_free(keys->allocator, keys->lengths);
+    sorter_free(keys->allocator, keys->prefixes);
+    memset(keys, 0, sizeof(SortKeys));
+}
+
+SorterError sort_library(Library * library, const ShelfOrder * order) {
+    SorterError error = library_require_fields(library, shelf_order_fields(order));
+    if(error != SORTER_OK) return error;
+
+    SortKeys keys;
+    error = build_sort_keys(library, order, &keys);
+    if(error != SORTER_OK) return error;
+
+    sort_rows(library->allocator, &keys, library->order, library->num_books, &compare_sort_keys);
+    library->shelf_version++;
+
+    destroy_sort_keys(&keys);
+    return SORTER_OK;
+}
+
+//----------------------------
+// one page of the shelf
+
+// shelf order with the input order as the tie breaker, which is what the stable sort_rows() gives;
+// select_rows() needs a comparator that never says two rows are the same
+static int compare_ranked(const void * _keys, unsigned int row_a, unsigned int row_b) {
+    int cmp = compare_sort_keys(_keys, row_a, row_b);
+    if(cmp != 0) return cmp;
+    return (row_a > row_b) - (row_a < row_b);
+}
+
+// moves every row of rows[0 .. num_rows) by author to the end, returning how many there were
+static unsigned int gather_author_at_end(const Library * library, unsigned int * rows, unsigned int num_rows, unsigned int author) {
+    unsigned int end = num_rows;
+    for(unsigned int i = num_rows; i-- > 0; ) {
+        if(library_code(library, AUTHOR, rows[i]) == author) swap_rows(rows, i, --end);
+    }
+    return num_rows - end;
+}
+
+static unsigned int gather_author_at_start(const Library * library, unsigned int * rows, unsigned int num_rows, unsigned int author) {
+    unsigned int start = 0;
+    for(unsigned int i = 0; i < num_rows; i++) {
+        if(library_code(library, AUTHOR, rows[i]) == author) swap_rows(rows, i, start++);
+    }
+    return start;
+}
+
+SorterError sort_library_range(Library * library, const ShelfOrder * order, unsigned int begin, unsigned int end) {
+    unsigned int num_books = library->num_books;
+    if(end > num_books) end = num_books;
+    if(begin >= end) return SORTER_OK;
+
+    SorterError error = library_require_fields(library, shelf_order_fields(order));
+    if(error != SORTER_OK) return error;
+
+    SortKeys keys;
+    error = build_sort_keys(library, order, &keys);
+    if(error != SORTER_OK) return error;
+
+    // order[begin .. end) ends up holding the right rows, in some order, and then gets sorted
+    unsigned int * rows = library->order;
+    select_rows(library->allocator, &keys, rows, num_books, begin, &compare_ranked);
+    if(end < num_books) select_rows(library->allocator, &keys, rows + begin, num_books - begin, end - begin, &compare_ranked);
+    sort_rows(library->allocator, &keys, rows + begin, end - begin, &compare_ranked);
+
+    if(library->num_collections > 0 && order_keeps_authors_together(order)) {
+        // a collection moves books around within their author, so the window grows to whole authors first;
+        // authors sort first, so the rest of the first and last authors' books are the ones right next to it
+        unsigned int low = begin - gather_author_at_end(library, rows, begin, library_code(library, AUTHOR, rows[begin]));
+        unsigned int high = end + gather_author_at_start(library, rows + end, num_books - end, library_code(library, AUTHOR, rows[end - 1]));
+        sort_rows(library->allocator, &keys, rows + low, begin - low, &compare_ranked);
+        sort_rows(library->allocator, &keys, rows + end, high - end, &compare_ranked);
+
+        for(unsigned int i = 0; i < library->num_collections; i++) {
+            const Collection * c = library->collections[i];
+
+            // apply_collections() goes by the first shelf position with the title, so this does too
+            bool found = false;
+            unsigned int first_row = 0;
+            for(unsigned int row = 0; row < num_books; row++) {
+                if(!str_equal_nocase(c->titles[0], library_value(library, TITLE, row))) continue;
+                if(!found || compare_ranked(&keys, row, first_row) < 0) first_row = row;
+                found = true;
+            }
+            if(!found) continue;
+
+            for(unsigned int position = low; position < high; position++) {
+                if(rows[position] == first_row) {
+                    apply_collection(library, c, position, low, high);
+                    break;
+                }
+            }
+        }
+    }
+
+    library->shelf_version++;
+    destroy_sort_keys(&keys);
+    return SORTER_OK;
+}
+
+//----------------------------
+// comparators on the library itself, for when building keys isn't worth it
+
+// author codes are in collation order, so this is just an integer compare
+int alphabetic_priority_author(const void * _library, unsigned int row_a, unsigned int row_b) {
+    const Library * library = (const Library *) _library;
+    unsigned int a = library_code(library, AUTHOR, row_a);
+    unsigned int b = library_code(library, AUTHOR, row_b);
+    return (a > b) - (a < b);
+}
+
+int alphabetic_priority_title(const void * _library, unsigned int row_a, unsigned int row_b) {
+    const Library * library = (const Library *) _library;
+    return alphabetic_priority_s(library_value(library, TITLE, row_a), library_value(library, TITLE, row_b));
+}
+
+// shelf order: by author, then by title
+// falls back on the raw title so that books comparing equal after sanitizing stay in a fixed order
+int alphabetic_priority_shelf(const void * _library, unsigned int row_a, unsigned int row_b) {
+    const Library * library = (const Library *) _library;
+    int cmp = alphabetic_priority_author(library, row_a, row_b);
+    if(cmp == 0) cmp = alphabetic_priority_title(library, row_a, row_b);
+    if(cmp == 0) cmp = strcmp(library_value(library, TITLE, row_a), library_value(library, TITLE, row_b));
+    return cmp;
+}
+
+int alphabetic_priority_s(const char * _a, const char * _b) {
+    char a[MAX_LINE_LENGTH]; // stack buffers, so this is safe to call from anywhere
+    char b[MAX_LINE_LENGTH];
+    sanitize_title(_a, a, sizeof(a));
+    sanitize_title(_b, b, sizeof(b));
+
+    size_t len_a = strlen(a);
+    size_t len_b = strlen(b);
+    size_t smallest_strlen = (len_a < len_b) ? len_a : len_b;
+
+    for(size_t i = 0; i < smallest_strlen; i++) {
+        int cmp = alphabetic_priority_c(a[i], b[i]);
+        if(cmp != 0) return cmp;
+    }
+
+    // "being" comes before "beingandtime"
+    if(len_a < len_b) return -1;
+    if(len_a > len_b) return 1;
+    return 0;
+}
+
+// wrapper for the above so i can use it in qsort()
+int alphabetic_priority_qsort_s(const void * _a, const void * _b) {
+    const char * a = *(char **) _a;
+    const char * b = *(char **) _b;
+    return alphabetic_priority_s(a, b);
+}
+
+int alphabetic_priority_c(char a, char b) {
+    if(a < b) return -1;
+    if(a > b) return 1;
+    return 0; // a == b
+}
+
+// remove all spaces, remove "the," "on," "an," "a," turn all letters lowercase
+// this makes titles just slightly fuzzy which might be useful in future
+// "Being And Time" should equal "Being and Time" => "beingandtime"
+// runs of digits are kept, as a length byte and then the digits without leading zeros,
+// so "Volume 2" => "volume\x01" "2" comes before "Volume 10" => "volume\x02" "10" by plain byte comparison
+// (length bytes are at most MAX_NUMBER_DIGITS, well below any letter, so numbers sort before words)
+#define MAX_NUMBER_DIGITS 31
+
+char * sanitize_title(const char * title, char * output_buf, size_t output_buf_size) {
+    memset(output_buf, 0, output_buf_size);
+    size_t output_buf_idx = 0;
+
+    size_t beginning_offset = 0;
+    // i LOVE macros for eliminating redundant code
+    // this could NEVER go wrong <3
+    #define OFFSET(str) if(strncmp(title, str, strlen(str)) == 0) beginning_offset = strlen(str)
+
+    OFFSET("The ");
+    OFFSET("An ");
+    OFFSET("On ");
+    OFFSET("A ");
+
+    #undef OFFSET
+
+    size_t title_len = strlen(title);
+    for(size_t i = beginning_offset; (i < title_len) && (output_buf_idx + 1 < output_buf_size); i++) {
+        char c = title[i];
+
+        if((c >= '0') && (c <= '9')) {
+            size_t run_end = i;
+            while((run_end < title_len) && (title[run_end] >= '0') && (title[run_end] <= '9')) run_end++;
+            while((i + 1 < run_end) && (title[i] == '0')) i++; // "007" is 7, but "0" is still 0
+
+            size_t num_digits = run_end - i;
+            if(num_digits > MAX_NUMBER_DIGITS) num_digits = MAX_NUMBER_DIGITS; // nobody numbers volumes this high
+            if(output_buf_idx + 1 + num_digits + 1 > output_buf_size) break;
+
+            output_buf[output_buf_idx++] = (char) num_digits;
+            memcpy(output_buf + output_buf_idx, title + i, num_digits);
+            output_buf_idx += num_digits;
+
+            i = run_end - 1;
+            continue;
+        }
+
+        if(c != ' ') { // exclude spaces
+            if((c >= 'A') && (c <= 'Z')) c += 'a' - 'A'; // decapitalize capitals
+
+            if((c >= 'a') && (c <= 'z')) { // only include alphabetical characters
+                // append to buf
+                output_buf[output_buf_idx] = c;
+                output_buf_idx++;
+            }
+        }
+    }
+
+    return output_buf;
+}
+
+// "2024 December" -> 202412, "2024" -> 202400, anything else -> 0
+// the year and month can come in either order, and months only need their first three letters
+int parse_date(const char * date) {
+    static const char * const MONTHS[12] = { "jan", "feb", "mar", "apr", "may", "jun", "jul", "aug", "sep", "oct", "nov", "dec" };
+    int year = 0;
+    int month = 0;
+
+    const char * cursor = date;
+    while(*cursor != '\0') {
+        if(*cursor >= '0' && *cursor <= '9') {
+            // only four digit numbers are years, so anything longer isn't accumulated (and can't overflow)
+            int number = 0;
+            int num_digits = 0;
+            while(*cursor >= '0' && *cursor <= '9') {
+                if(num_digits++ < 4) number = number * 10 + (*cursor - '0');
+                cursor++;
+            }
+            if(num_digits == 4 && number >= 1000) year = number;
+        }
+        else if((*cursor >= 'A' && *cursor <= 'Z') || (*cursor >= 'a' && *cursor <= 'z')) {
+            const char * word = cursor;
+            while((*cursor >= 'A' && *cursor <= 'Z') || (*cursor >= 'a' && *cursor <= 'z')) cursor++;
+            if(cursor - word >= 3) {
+                for(int m = 0; m < 12; m++) {
+                    bool matches = true;
+                    for(int c = 0; c < 3; c++) {
+                        char letter = word[c];
+                        if(letter >= 'A' && letter <= 'Z') letter += 'a' - 'A';
+                        if(letter != MONTHS[m][c]) matches = false;
+                    }
+                    if(matches) month = m + 1;
+                }
+            }
+        }
+        else cursor++;
+    }
+
+    if(year == 0) return 0;
+    return year * 100 + month;
+}
+
+// "Author" -> AUTHOR; false if name isn't a field
+bool parse_field_name(const char * name, size_t len, BookField * field) {
+    for(int i = 0; i < EXPECTED_NUMBER_OF_FIELDS; i++) {
+        if(strlen(FIELD_NAMES[i]) != len) continue;
+
+        bool matches = true;
+        for(size_t c = 0; c < len; c++) {
+            char letter = name[c];
+            if(letter >= 'A' && letter <= 'Z') letter += 'a' - 'A';
+            if(letter != FIELD_NAMES[i][c]) matches = false;
+        }
+
+        if(matches) {
+            *field = (BookField) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// python: "if value in values"
+bool string_is_member(const char ** values, unsigned int num_values, const char * value) {
+    for(unsigned int i = 0; i < num_values; i++) {
+        if(str_equal(values[i], value)) return true;
+    }
+    return false;
+}
+
+// turns all capitals into lowercase
+// "Being And Time" -> "being and time"
+// this is NOT sanitize_title()
+char * make_lowercase_string(const char * string, char * output_buf, size_t output_buf_size) {
+    memset(output_buf, 0, output_buf_size);
+    size_t output_buf_idx = 0;
+
+    for(size_t i = 0; (string[i] != '\0') && (output_buf_idx + 1 < output_buf_size); i++) {
+        char c = string[i];
+        if((c >= 'A') && (c <= 'Z')) c += 'a' - 'A';
+
+        // append to buf
+        output_buf[output_buf_idx] = c;
+        output_buf_idx++;
+    }
+
+    return output_buf;
+}
+
+// boolean wrapper for strcmp()
+bool str_equal(const char * str1, const char * str2) {
+    return (strcmp(str1, str2) == 0);
+}
+
+// same as above, but "Being And Time" equals "being and time"
+// compares in place, so there's no need for make_lowercase_string() buffers
+bool str_equal_nocase(const char * str1, const char * str2) {
+    for(;; str1++, str2++) {
+        char a = *str1;
+        char b = *str2;
+        if((a >= 'A') && (a <= 'Z')) a += 'a' - 'A';
+        if((b >= 'A') && (b <= 'Z')) b += 'a' - 'A';
+        if(a != b) return false;
+        if(a == '\0') return true;
+    }
+}
+
+//----------------------------
+// Library searcher implementations
+
+// returns the shelf position of the first book whose field matches value (ignoring case), or -1
+int get_idx_by_value(const Library * library, const char * value, BookField field) {
+    for(unsigned int i = 0; i < library->num_books; i++) {
+        if(str_equal_nocase(value, library_value(library, field, library->order[i]))) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+int get_idx_by_title(const Library * library, const char * title) {
+    return get_idx_by_value(library, title, TITLE);
+}
+
+int get_idx_by_author(const Library * library, const char * author) {
+    return get_idx_by_value(library, author, AUTHOR);
+}
+
+int get_idx_by_contributor(const Library * library, const char * contributor) {
+    return get_idx_by_value(library, contributor, CONTRIBUTOR);
+}
+
+int get_idx_by_subject(const Library * library, const char * subject) {
+    return get_idx_by_value(library, subject, SUBJECT);
+}
+
+int get_idx_by_status(const Library * library, const char * status) {
+    return get_idx_by_value(library, status, STATUS);
+}
+
+int get_idx_by_date(const Library * library, const char * date) {
+    return get_idx_by_value(library, date, DATE);
+}
+
+int get_idx_by_isbn_s(const Library * library, const char * isbn_s) {
+    return get_idx_by_value(library, isbn_s, ISBN_S);
+}
+
+//----------------------------
+// field getter implementations
+
+const char * get_field_title(const Library * library, unsigned int position) {
+    return library_value(library, TITLE, library->order[position]);
+}
+
+const char * get_field_author(const Library * library, unsigned int position) {
+    return library_value(library, AUTHOR, library->order[position]);
+}
+
+const char * get_field_contributor(const Library * library, unsigned int position) {
+    return library_value(library, CONTRIBUTOR, library->order[position]);
+}
+
+const char * get_field_subject(const Library * library, unsigned int position) {
+    return library_value(library, SUBJECT, library->order[position]);
+}
+
+const char * get_field_status(const Library * library, unsigned int position) {
+    return library_value(library, STATUS, library->order[position]);
+}
+
+const char * get_field_date(const Library * library, unsigned int position) {
+    return library_value(library, DATE, library->order[position]);
+}
+
+const char * get_field_isbn_s(const Library * library, unsigned int position) {
+    return library_value(library, ISBN_S, library->order[position]);
+}
@@ -1,17 +1,96 @@
+#ifndef SORTER_H
+#define SORTER_H
+
 #include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <stdarg.h>
 #include <stdbool.h>
-#include <assert.h>
+#include <signal.h>
+#include <pthread.h>
 
 // just copy paste this from the Excel output
+// the header is matched column by column at runtime (see FIELD_HEADERS in sorter.c), so the columns
+// can come in any order and extra ones are ignored; this is what the error message shows
 #define EXPECTED_HEADER "TITLE	AUTHOR(s)	\"TRANSLATOR(s), EDITOR(s), etc.\"	SUBJECT	STATUS	DATE	ISBN\n"
 #define EXPECTED_NUMBER_OF_FIELDS 7
 
+// longest field we keep from the input file; longer ones are cut short
+#define MAX_LINE_LENGTH 512
+
+// most predicates one query (or one command line) can hold
+#define MAX_PREDICATES 16
+
+#define USAGE_MESSAGE "USAGE:\nsort <required: input filename> <optional: output filename> <optional: --where PREDICATE ...> <optional: --report> <optional: --order FIELDS> <optional: --search TEXT> <optional: --serve SOCKET> <optional: --memory> <optional: --batch> <optional: --range N:M> <optional: --site DIRECTORY>\nIf no filename is given, output will be to stdout (OUTPUT_STDOUT).\nIf a filename matching \"web.html\" if given, then it will output in the format necessary for wrzeczak.net (OUTPUT_WEBSITE).\nIf another filename ending in \".html\" is given, it will output in a nicely formatted HTML table (OUTPUT_HTML).\nIf any other filename is given, it will output in tab-delimited text format (OUTPUT_TXT).\n--where keeps only the books matching PREDICATE, e.g. \"status=None\", \"subject^=Philosophy\" or \"date>=2024 January\" (undated books match no date predicate, not even !=); give it more than once (or join predicates with &&) to narrow further.\n--report writes book counts by subject, status and month acquired instead of the books themselves.\n--order shelves by other fields, e.g. \"subject,author,title\" or \"-date,title\" (- for descending); the default is \"author,title\".\n--search lists the books whose title or author is closest to TEXT, best match first; typos are fine.\n--serve keeps the library loaded and answers requests on the unix socket SOCKET instead of writing anything; see server.c. Filters and searches are requests there, so it doesn't mix with --where, --search, --report, --range or --site.\n--memory also prints how much memory each stage allocated, to stderr; all of a --batch or --serve run is one stage.\n--batch sorts many catalogs at once: the input is then a directory of .txt/.csv catalogs (written to the output directory, as .txt) or a manifest of \"input<TAB>output\" lines, and a summary of each catalog is printed at the end; --where and --order apply to all of them.\n--range writes only books N to M of the shelf (numbered from 1, like the output), without sorting the rest; it doesn't mix with --where, --search or --report.\n--site writes the shelf as a directory of web pages, one per letter of the author plus an index, instead of an output file; only pages that changed since the last --site are rewritten.\n\n"
+
+//------------------------------------------------------------------------------
+// everything in here is reentrant: no static buffers, no exit()
+// functions that can fail return a SorterError and write their results through
+// caller-owned pointers, so several libraries can be sorted at once
+
+typedef enum {
+    SORTER_OK = 0,
+    SORTER_ERR_USAGE,           // bad command line
+    SORTER_ERR_INPUT_FILE,      // couldn't open the input file
+    SORTER_ERR_OUTPUT_FILE,     // couldn't open the output file
+    SORTER_ERR_HEADER,          // input header has no title or no author column
+    SORTER_ERR_OUT_OF_MEMORY,
+    SORTER_ERR_BAD_COLLECTION,  // a collection needs at least two titles
+    SORTER_ERR_TITLE_NOT_FOUND, // a collection names a title that isn't in the library
+    SORTER_ERR_BAD_QUERY,       // a --where predicate didn't parse
+    SORTER_ERR_BAD_ORDER,       // an --order spec didn't parse
+    SORTER_ERR_SOCKET,          // couldn't set up the --serve socket
+    SORTER_ERR_BAD_INPUT        // a quoted field in the input never ends
+} SorterError;
+
+const char * sorter_strerror(SorterError error);
+
+//------------------------------------------------------------------------------
+// memory
+// everything the library allocates goes through a SorterAllocator, so it can be swapped out or watched
+// a NULL allocator means plain malloc() and friends
+// each struct that owns memory remembers the allocator it was built with, so destroy_*() can give it back
+
+typedef struct {
+    void * (*allocate)(void * context, size_t size);
+    void * (*reallocate)(void * context, void * pointer, size_t size);
+    void (*release)(void * context, void * pointer);
+    void * context;
+} SorterAllocator;
+
+void * sorter_malloc(const SorterAllocator * allocator, size_t size);
+void * sorter_calloc(const SorterAllocator * allocator, size_t count, size_t size);
+void * sorter_realloc(const SorterAllocator * allocator, void * pointer, size_t size);
+void sorter_free(const SorterAllocator * allocator, void * pointer);
+
+// a SorterAllocator that counts what goes through it (allocator.c)
+// counts are kept per stage, e.g. "parse", "sort", "output", to see where the memory goes
+
+#define MAX_ALLOCATION_STAGES 16
+
+typedef struct {
+    const char * name;
+    unsigned long long allocations;     // sorter_malloc()s and sorter_calloc()s
+    unsigned long long reallocations;
+    unsigned long long frees;
+    unsigned long long bytes_allocated; // everything asked for, including what realloc()s grew by
+    size_t peak_live;                   // most bytes live at once during the stage
+    size_t live_at_end;
+} AllocationStage;
+
+typedef struct {
+    SorterAllocator allocator;          // give &tracker->allocator to the library
+    AllocationStage stages[MAX_ALLOCATION_STAGES];
+    unsigned int num_stages;
+    size_t live;                        // bytes allocated right now
+    pthread_mutex_t lock;               // reports and output allocate from worker threads
+} TrackingAllocator;
+
+void init_tracking_allocator(TrackingAllocator * tracker);
+void begin_allocation_stage(TrackingAllocator * tracker, const char * name); // everything until the next stage counts towards this one
+void write_allocation_report(TrackingAllocator * tracker, FILE * output_file);
+void destroy_tracking_allocator(TrackingAllocator * tracker);
+
 //------------------------------------------------------------------------------
 
-typedef enum { // see Book for explanations
+typedef enum { // see get_field_*() for explanations
     TITLE,
     AUTHOR,
     CONTRIBUTOR,
@@ -21,15 +100,42 @@ typedef enum { // see Book for explanations
     ISBN_S
 } BookField;
 
+// one field's worth of values for every book, packed back to back in a single blob
+// value i is blob + offsets[i], lengths[i] bytes long and '\0' terminated
+// plain columns have one value per row, in input order; the shelf order lives in Library.order
+// dictionary columns store each distinct value once and give every row a code instead
+typedef struct {
+    char * blob;
+    size_t blob_size;
+    size_t blob_capacity;
+    unsigned int * offsets;
+    unsigned int * lengths;
+    unsigned int num_values;
+    unsigned int values_capacity;
+
+    bool is_dictionary;
+    unsigned int * codes;       // codes[row] = value; values are sorted by collation, so codes compare like the strings do
+    unsigned int * hash_slots;  // interning table, only alive while parsing
+    unsigned int hash_capacity;
+
+    bool materialized;          // false while the values are still only in Library.source; see library_require_fields()
+} StringColumn;
+
+// sets of fields, as bit masks
+#define FIELD_BIT(field) (1u << (field))
+#define ALL_FIELDS ((1u << EXPECTED_NUMBER_OF_FIELDS) - 1)
+
+// which column of the input file each field came from, worked out from its header
 typedef struct {
-    char * title;           // the title of the work;   "Being and Time"
-    char * author;          // the author(s);           "Martin Heidegger"
-    char * contributor;     // anyone else, not above;  "trans. Macquarrie and Robinson"
-    char * subject;         // general grouping;        "Philosophy; Metaphysics"
-    char * status;          // how much i've read;      "None"
-    char * date;            // abou when i got it;      "2024 December"
-    char * isbn_s;          // ISBN in string form;     "978006157594"
-} Book;
+    int file_columns[EXPECTED_NUMBER_OF_FIELDS]; // -1 if the file doesn't have that field; its values are all empty
+    char delimiter;
+} ColumnSchema;
+
+// fields whose values repeat enough to be worth a dictionary
+extern const bool FIELD_IS_DICTIONARY[EXPECTED_NUMBER_OF_FIELDS];
+
+// lowercase names for each field, as used on the command line: "title", "author", ...
+extern const char * const FIELD_NAMES[EXPECTED_NUMBER_OF_FIELDS];
 
 // currently, collections assume a couple shaky things:
 // 1) they are only of one author (not a terrible assumption, but not the most general)
@@ -40,91 +146,102 @@ typedef struct {
     unsigned int num_titles;    // as above
 } Collection;
 
+// the library is the caller-owned context for everything below
+// fill it with parse_library(), release it with destroy_library()
+// books are stored by column rather than by book: scanning one field walks one contiguous blob,
+// and sorting only shuffles the 4-byte row numbers in order[]
 typedef struct {
-    Book ** books;
+    StringColumn columns[EXPECTED_NUMBER_OF_FIELDS]; // indexed by BookField; see below for explanations
+    unsigned int * order;       // order[position] = row; this is what gets sorted
+    unsigned int shelf_version; // goes up whenever order[] changes, so anything kept by position knows to redo it
+    int * acquired;             // acquired[row] = parse_date() of DATE, e.g. 202412; filled in while parsing
     unsigned int num_books;
     unsigned int books_capacity;
 
     Collection ** collections;
     unsigned int num_collections;
     unsigned int collections_capacity;
+
+    struct SearchIndex * search_index; // built the first time something needs a fuzzy lookup; see search.c
+    const SorterAllocator * allocator; // what everything above was allocated with
+
+    // columns nobody has asked for yet aren't read out of the input; it's kept here until they all have been
+    ColumnSchema schema;
+    char * source;
+    size_t source_size;
+
+    // extra context for the last error, e.g. the bad header
+    // add_collection() also leaves a note here when it succeeds by swapping in a close match for a title
+    char error_detail[2 * MAX_LINE_LENGTH];
 } Library;
 
 //----------------------------
-// forward declarations for primary functions
-
-int get_idx_by_title(Library * library, const char * title);
-int get_idx_by_author(Library * library, const char * author);
-int get_idx_by_contributor(Library * library, const char * contributor);
-int get_idx_by_subject(Library * library, const char * subject);
-int get_idx_by_status(Library * library, const char * status);
-int get_idx_by_date(Library * library, const char * date);
-int get_idx_by_isbn_s(Library * library, const char * isbn_s);
-
-typedef int (*book_field_searcher)(Library *, const char *);
-const book_field_searcher get_by[] = {
-    [TITLE] = get_idx_by_title,
-    [AUTHOR] = get_idx_by_author,
-    [CONTRIBUTOR] = get_idx_by_contributor,
-    [SUBJECT] = get_idx_by_subject,
-    [STATUS] = get_idx_by_status,
-    [DATE] = get_idx_by_date,
-    [ISBN_S] = get_idx_by_isbn_s,
-};
-
-char * get_field_title(Book * book);
-char * get_field_author(Book * book);
-char * get_field_contributor(Book * book);
-char * get_field_subject(Book * book);
-char * get_field_status(Book * book);
-char * get_field_date(Book * book);
-char * get_field_isbn_s(Book * book);
-
-typedef char * (*book_field_getter)(Book *);
-const book_field_getter get_field[] = {
-    [TITLE] = get_field_title,
-    [AUTHOR] = get_field_author,
-    [CONTRIBUTOR] = get_field_contributor,
-    [SUBJECT] = get_field_subject,
-    [STATUS] = get_field_status,
-    [DATE] = get_field_date,
-    [ISBN_S] = get_field_isbn_s
-};
-
-char * verify_header(FILE * input_file);
-Book * get_book_from_line(const char * line);
-int alphabetic_priority_author(const void * _book_a, const void * _book_b);
-int alphabetic_priority_title(const void * _book_a, const void * _book_b);
-int alphabetic_priority_qsort_s(const void * _a, const void * _b);
-bool string_is_member(const char ** values, unsigned int num_values, const char * value);
-int get_idx_by_value(Book ** library, unsigned int num_books, const char * value, BookField field);
-bool str_equal(const char * str1, const char * str2); // boolean wrapper for strcmp()
+// field access
+
+int get_idx_by_title(const Library * library, const char * title);
+int get_idx_by_author(const Library * library, const char * author);
+int get_idx_by_contributor(const Library * library, const char * contributor);
+int get_idx_by_subject(const Library * library, const char * subject);
+int get_idx_by_status(const Library * library, const char * status);
+int get_idx_by_date(const Library * library, const char * date);
+int get_idx_by_isbn_s(const Library * library, const char * isbn_s);
+
+typedef int (*book_field_searcher)(const Library *, const char *);
+extern const book_field_searcher get_by[EXPECTED_NUMBER_OF_FIELDS];
+
+// what each field holds:
+// TITLE        the title of the work;   "Being and Time"
+// AUTHOR       the author(s);           "Martin Heidegger"
+// CONTRIBUTOR  anyone else, not above;  "trans. Macquarrie and Robinson"
+// SUBJECT      general grouping;        "Philosophy; Metaphysics"
+// STATUS       how much i've read;      "None"
+// DATE         abou when i got it;      "2024 December"
+// ISBN_S       ISBN in string form;     "978006157594"
+
+// value of a field by row (input order)
+static inline const char * library_value(const Library * library, BookField field, unsigned int row) {
+    const StringColumn * column = &library->columns[field];
+    unsigned int value = column->is_dictionary ? column->codes[row] : row;
+    return column->blob + column->offsets[value];
+}
+
+// dictionary code of a field by row; only for FIELD_IS_DICTIONARY fields
+static inline unsigned int library_code(const Library * library, BookField field, unsigned int row) {
+    return library->columns[field].codes[row];
+}
+
+// the getters below take a shelf position, i.e. they go through order[]
+const char * get_field_title(const Library * library, unsigned int position);
+const char * get_field_author(const Library * library, unsigned int position);
+const char * get_field_contributor(const Library * library, unsigned int position);
+const char * get_field_subject(const Library * library, unsigned int position);
+const char * get_field_status(const Library * library, unsigned int position);
+const char * get_field_date(const Library * library, unsigned int position);
+const char * get_field_isbn_s(const Library * library, unsigned int position);
+
+typedef const char * (*book_field_getter)(const Library *, unsigned int);
+extern const book_field_getter get_field[EXPECTED_NUMBER_OF_FIELDS];
 
 //------------------------------------------------------------------------------
 // primary functions - stuff that gets called directly in main()
 
-struct parse_args_ret_t {
+typedef struct {
     char * input_filename;
     char * output_filename;
-};
-
-struct parse_args_ret_t parse_args(int argc, char ** argv) {
-    static struct parse_args_ret_t output = { 0 };
-    
-    if(argc < 2) {
-        printf("USAGE:\nsort <required: input filename> <optional: output filename>\nIf no filename is given, output will be to stdout (OUTPUT_STDOUT).\nIf a filename matching \"web.html\" if given, then it will output in the format necessary for wrzeczak.net (OUTPUT_WEBSITE).\nIf another filename ending in \".html\" is given, it will output in a nicely formatted HTML table (OUTPUT_HTML).\nIf any other filename is given, it will output in tab-delimited text format (OUTPUT_TXT).\n\n");
-        exit(1);
-    }
 
-    output.input_filename = argv[1];
-
-    if(argc >= 3) output.output_filename = argv[2];
-    else output.output_filename = NULL;
-
-    return output;
-}
-
-//----------------------------
+    const char * where[MAX_PREDICATES]; // --where expressions, all of which have to match
+    unsigned int num_where;
+    bool report;                        // --report
+    const char * order;                 // --order, or NULL for DEFAULT_SHELF_ORDER
+    const char * search;                // --search, or NULL
+    const char * serve;                 // --serve socket path, or NULL
+    bool memory;                        // --memory
+    bool batch;                         // --batch: input_filename is a directory or manifest, output_filename a directory
+    const char * site;                  // --site output directory, or NULL
+    bool range;                         // --range: only shelf positions range_begin .. range_end - 1 (from 0)
+    unsigned int range_begin;
+    unsigned int range_end;
+} SorterArgs;
 
 typedef enum {
     OUTPUT_STDOUT = 0,
@@ -133,644 +250,346 @@ typedef enum {
     OUTPUT_WEBSITE // for wrzeczak.net's bookshelf page
 } OutputFormat;
 
-struct open_files_ret_t {
+typedef struct {
     FILE * input_file;
     FILE * output_file;
     OutputFormat output_format;
-};
-
-struct open_files_ret_t open_files(struct parse_args_ret_t args) {
-    static struct open_files_ret_t output = { 0 };
-
-    output.input_file = fopen(args.input_filename, "r");
-    if(args.output_filename == NULL) {
-        // by default, OUTPUT_STDOUT
-        output.output_file = NULL;
-        output.output_format = OUTPUT_STDOUT;
-    } else {
-        output.output_file = fopen(args.output_filename, "w");
-        size_t output_filename_len = strlen(args.output_filename);
-        // here i actually need strncmp for slicing strings
-        if(strncmp(".html", args.output_filename + (output_filename_len - 5), strlen(".html")) == 0) {
-            if(strncmp("web", args.output_filename, strlen("web")) == 0) output.output_format = OUTPUT_WEBSITE;
-            else output.output_format = OUTPUT_HTML;
-        }
-        else output.output_format = OUTPUT_TXT;
-    }
-
-    return output;
-}
-
-//----------------------------
-
-Library parse_library(FILE * input_file) {
-    static Library output = { 0 };
-    output.books_capacity = 2;
-    output.num_books = 0;
-    
-    char * header_line = verify_header(input_file); // does not rewind()
-    
-    if(header_line != NULL) {
-        printf("ERROR: Header mismatch!\n Expected \""EXPECTED_HEADER"\" Found \"%s\"!\n", header_line);
-        exit(2);
-    }
-    
-    char line[512];
-    memset(line, 0, 512);
-    output.books = (Book **) calloc(output.books_capacity, sizeof(Book *));
-    
-    while(fgets(line, 512, input_file) != NULL) {
-        if(output.num_books >= output.books_capacity) {
-            output.books_capacity *= 2;
-            output.books = realloc(output.books, output.books_capacity * sizeof(Book *));
-        }
-        output.books[output.num_books] = get_book_from_line(line);
-        output.num_books++;
-    }
-    
-    fclose(input_file);
-    
-    return output;
-}
-
-//----------------------------
-
-void sort_by_author(Library * library) {
-    // sort alphabetically by author
-    qsort(library->books, library->num_books, sizeof(Book *), &alphabetic_priority_author);
-    
-    // get every author with multiple entries
-    char * authors_multiple[library->num_books];
-    unsigned int am_idx = 0;
-    
-    // search for authors with multiple entries; only works if they are sorted by author name
-    char * last_author = NULL;
-    for(unsigned int i = 1; i < library->num_books; i++) {
-        last_author = library->books[i - 1]->author;
-        if(str_equal(last_author, library->books[i]->author)) {
-            if(!string_is_member((const char **) authors_multiple, am_idx, last_author)) {
-                authors_multiple[am_idx] = last_author;
-                am_idx++;
-            }
-        }
-    }
-    
-    // maybe i could do this in one loop, but i'll do it in two for the sake of code simplicity
-    unsigned int author_spans[am_idx];
-    unsigned int author_begins[am_idx];
-    
-    // get how many books are under each author's name
-    for(unsigned int i = 0; i < am_idx; i++) {
-        char * author = authors_multiple[i];
-        unsigned int start_idx = get_by[AUTHOR](library, author); // only works if sorted by author AND if get_idx_by_value() returns the first instance of value
-        
-        unsigned int author_count = 1;
-        char * next_author = library->books[start_idx + author_count]->author;
-        while(((start_idx + author_count) < library->num_books)
-              && (str_equal(next_author, author))) {
-            author_count++;
-            next_author = library->books[start_idx + author_count]->author;
-        }
-        
-        // now, get all the books of that author
-        Book * author_books[author_count];
-        
-        memcpy(author_books, library->books + (unsigned char) start_idx, author_count * sizeof(Book *));
-        qsort(author_books, author_count, sizeof(Book *), &alphabetic_priority_title);
-        
-        // sorted, now copy
-        memcpy(library->books + (unsigned char) start_idx, author_books, author_count * sizeof(Book *));
-    }
-}
-
-//----------------------------
-
-void add_collection(Library * library, unsigned int num_titles, ...) {
-    if(num_titles < 2) {
-        printf("Bad collection at %d. Kill yourself.\n", __LINE__); // will this __LINE__ be in the 500s or at the callsite? doesn't matter. kill yourself.
-        exit(-80085);
-    }
-
-    va_list args;               // if macros are my favorite feature then varargs are my second favorite
-    va_start(args, num_titles); // although python does these in an infinitely safer and way better way
-
-    Collection * coll = malloc(sizeof(Collection));
-    coll->titles = malloc(sizeof(char *));
-    coll->num_titles = 0;
-
-    for(unsigned int i = 0; i < num_titles; i++) {
-        char * title = va_arg(args, char *);
-
-        coll->num_titles++;
-        coll->titles = realloc(coll->titles, coll->num_titles * sizeof(char *));
-        coll->titles[coll->num_titles - 1] = malloc(strlen(title) + 1);
-        memset(coll->titles[coll->num_titles - 1], 0, strlen(title) + 1);
-        memcpy(coll->titles[coll->num_titles - 1], title, strlen(title) + 1);
-    }
-
-    for(unsigned int i = 0; i < coll->num_titles; i++) {
-        if(get_by[TITLE](library, coll->titles[i]) == -1) {
-            printf("It's so fucking over. \"%s\" is not in the library. Fuck. Eggplant ratatouille.\n", coll->titles[i]);
-            exit(67);
-        }
-    }
-
-    library->num_collections++;
-    library->collections = realloc(library->collections, library->num_collections * sizeof(Collection *));
-    library->collections[library->num_collections - 1] = coll;
-}
-
-//----------------------------
-
-void apply_collections(Library * library) {
-    unsigned int num_collections = library->num_collections;
-    unsigned int num_books = library->num_books;
-    Book ** books = library->books;
-    Collection ** collections = library->collections;
-
-    for(unsigned int i = 0; i < num_collections; i++) {
-        Collection c = *(collections[i]);
-        char * first_title = c.titles[0];
-
-        unsigned int first_title_idx = get_by[TITLE](library, first_title);
-
-        // now, re-sort all the author's titles
-        char * author = books[first_title_idx]->author;
-        unsigned int author_start_idx = get_by[AUTHOR](library, author);
-
-        // get author span
-        unsigned int span = 1;
-        char * next_author = books[author_start_idx + span]->author;
-        while(str_equal(next_author, author)) {
-            span++;
-            next_author = books[author_start_idx + span]->author;
-        }
-
-        unsigned int num_noncollected_titles = (span - c.num_titles) + 1; // +1 for the first member of the title, which we will treat as noncollected
-        char * noncollected_titles[num_noncollected_titles];
-        unsigned int num_titles_before = first_title_idx - author_start_idx;
-        unsigned int num_titles_after = num_noncollected_titles - num_titles_before - 1;
-
-        unsigned int collected_titles_found = 0;
-        for(unsigned int j = 0; j < span; j++) {
-            char * title = books[author_start_idx + j]->title;
-            // string_is_member() causes problems here??
-            bool is_in_collection = false;
-
-            for(unsigned int k = 1; k < c.num_titles; k++) { // k = 1 to skip first member of collection
-                if(str_equal(c.titles[k], title)) is_in_collection = true;
-            }
-
-            if(!is_in_collection) {
-                // append to noncol
-                noncollected_titles[j - collected_titles_found] = title;
-            } else {
-                collected_titles_found++; // do not append and note it has been skipped
-            }
-        }
-
-        // sort the noncollected titles
-        qsort(noncollected_titles, num_noncollected_titles, sizeof(char *), &alphabetic_priority_qsort_s);
-
-        for(unsigned int j = 0; j < num_noncollected_titles; j++) {
-            if(str_equal(noncollected_titles[j], c.titles[0])) {
-                num_titles_before = j;
-                num_titles_after = span - num_titles_before - c.num_titles;
-            }
-        }
-
-        // now, stitch everything up
-        char * collected_titles[span];
-
-        for(unsigned int j = 0; j < num_titles_before; j++) {
-            collected_titles[j] = noncollected_titles[j];
-        }
-
-        for(unsigned int j = 0; j < c.num_titles; j++) {
-            collected_titles[j + num_titles_before] = c.titles[j];
-        }
-
-        for(unsigned int j = 0; j < num_titles_after; j++) { // not doing the offsets implicitly becausae they are too complex :(
-            collected_titles[j + num_titles_before + c.num_titles] = noncollected_titles[j + num_titles_before + 1];
-        }
-        
-        // how about that variable name!
-        Book * collected_titles_in_book_form = malloc(span * sizeof(Book));
-
-        // deep copy the data from books in the order listed in the (properly sorted) collected_titles
-        for(unsigned int j = 0; j < span; j++) {
-            char * title = collected_titles[j];
-            collected_titles_in_book_form[j] = *(books[get_by[TITLE](library, title)]); // DEEP COPY!
-        }
-
-        // overwrite books with the properly sorted books
-        for(unsigned int j = 0; j < span; j++) {
-            *(library->books[author_start_idx + j]) = collected_titles_in_book_form[j];
-        }
-
-        free(collected_titles_in_book_form);
-    }
-}
-
-//----------------------------
-
-void do_output(Library library, FILE * output_file, OutputFormat output_format) {
-    const char * txt_format_str = "%3d: %-*s %s\n";
-
-    const char * html_preamble = "<style>\n\tbody {\n\t\tcolor: white;\n\t\tbackground-color: #222;\n\t}\n</style>\n\n<table style=\"width: 100%%;\">\n\t<tr>\n\t\t<th>NUMBER</th>\n\t\t<th>TITLE</th>\n\t\t<th>AUTHOR</th>\n\t</tr>\n";
-    const char * html_format_str = "\t<tr>\n\t\t<td>%d</td>\n\t\t<td>%s</td>\n\t\t<td>%s</td>\n\t</tr>\n";
-
-    const char * website_format_str = "<tr><td>%s</td><td>%s</td></tr>";
-    const char * website_preamble = "<table style=\"width: 100%%;\"><tr><th>TITLE</th><th>AUTHOR</th></tr> ";
-    
-    size_t longest_title_length = 0;
-    for(unsigned int i = 0; i < library.num_books; i++) {
-        size_t len = strlen(library.books[i]->title);
-        if(len > longest_title_length) {
-            longest_title_length = len;
-        }
-    }
-
-    switch(output_format) {
-        case OUTPUT_STDOUT: {
-            for(unsigned int i = 0; i < library.num_books; i++) {
-                printf(txt_format_str, i + 1, longest_title_length, library.books[i]->title, library.books[i]->author);
-            }
-            break;
-        }
-        case OUTPUT_TXT: {
-            for(unsigned int i = 0; i < library.num_books; i++) {
-                fprintf(output_file, txt_format_str, i + 1, longest_title_length, library.books[i]->title, library.books[i]->author);
-            }
-            break;
-        }
-        case OUTPUT_HTML: {
-            fprintf(output_file, html_preamble);
-            for(unsigned int i = 0; i < library.num_books; i++) {
-                fprintf(output_file, html_format_str, i + 1, library.books[i]->title, library.books[i]->author);
-            }
-            break;
-        }
-        case OUTPUT_WEBSITE: {
-            fprintf(output_file, website_preamble);
-            for(unsigned int i = 0; i < library.num_books; i++) {
-                fprintf(output_file, website_format_str, library.books[i]->title, library.books[i]->author);
-            }
-            break;
-        }
-    }
-}
-
-//----------------------------
-
-void destroy_library(Library library) {
-    // free collections
-    for(unsigned int i = 0; i < library.num_collections; i++) {
-        for(unsigned int j = 0; j < library.collections[i]->num_titles; j++) {
-            free(library.collections[i]->titles[j]);
-        }
-        free(library.collections[i]->titles);
-        free(library.collections[i]);
-    }
-
-    // free books
-    for(unsigned int i = 0; i < library.num_books; i++) {
-        free(library.books[i]->author);
-        free(library.books[i]->contributor);
-        free(library.books[i]->date);
-        free(library.books[i]->isbn_s);
-        free(library.books[i]->status);
-        free(library.books[i]->subject);
-        free(library.books[i]->title);
-        free(library.books[i]);
-    }
-    free(library.books);
-}
+} SorterFiles;
+
+SorterError parse_args(int argc, char ** argv, SorterArgs * args);
+SorterError open_files(const SorterArgs * args, SorterFiles * files);
+OutputFormat output_format_for(const char * output_filename); // "web*.html", "*.html", anything else
+SorterError parse_library(FILE * input_file, const SorterAllocator * allocator, Library * library); // closes input_file; allocator may be NULL
+// the same, but only reads the columns in fields (title and author always), e.g. shelf_order_fields() | query_fields()
+SorterError parse_library_fields(FILE * input_file, const SorterAllocator * allocator, unsigned int fields, Library * library);
+// reads any of fields that parse_library_fields() skipped; sort_library() does this for its own fields,
+// but anything taking a const Library (queries, reports) needs its fields read beforehand
+SorterError library_require_fields(Library * library, unsigned int fields);
+void library_release_source(Library * library); // for when nothing more will be required; the unread columns stay empty
+SorterError sort_by_author(Library * library); // sort_library() with DEFAULT_SHELF_ORDER
+SorterError add_collection(Library * library, unsigned int num_titles, ...);
+void apply_collections(Library * library);
+void do_output(const Library * library, FILE * output_file, OutputFormat output_format);
+void do_output_positions(const Library * library, const unsigned int * positions, unsigned int num_positions, FILE * output_file, OutputFormat output_format);
+void destroy_library(Library * library);
 
 //------------------------------------------------------------------------------
-// secondary functions - not directly called by main()
-
-//----------------------------
-// forward declarations thereof
-
-char * sanitize_data(char * value);
-int alphabetic_priority_s(const char * _a, const char * _b);
-char * sanitize_title(const char * title);
-int alphabetic_priority_c(char a, char b);
-char * make_lowercase_string(const char * string);
-
-// make sure the input file matches what we expect
-// returns the header (first line) if it FAILS
-// RETURNS NULL ON SUCCESS
-// i know this is not an idiomatic design decision but unfortunately it does make sense
-char * verify_header(FILE * input_file) {
-    static char line[256]; // static because this is only called once
-    memset(line, 0, 256);
-    fgets(line, 256, input_file);
-
-    if(!str_equal(line, EXPECTED_HEADER)) {
-        return line;
-    } else return NULL;
-}
-
-// parse each line of the input file
-// this will not work on the first (header) line
-Book * get_book_from_line(const char * line) {
-    Book * output = malloc(sizeof(Book));
-
-    char * token = sanitize_data(strtok((char *) line, "\t"));
-    output->title = malloc(strlen(token) + 1);
-    memcpy(output->title, token, strlen(token) + 1);
-
-    // MACROS!!! MACROS!!!! YIPPPEEE!!!!!
-    // i love doing these little time saver macros so much
-    // i know some people hate them but macros are genuinely my favorite C feature
-    // they're so useful (and so enticingly pernicious... danger... intrigue...)
-    #define GET_FIELD(field) do { \
-        token = sanitize_data(strtok(NULL, "\t")); \
-        output->field = malloc(strlen(token) + 1); \
-        memcpy(output->field, token, strlen(token) + 1); \
-    } while(0); 
-
-    GET_FIELD(author);
-    GET_FIELD(contributor);
-    GET_FIELD(subject);
-    GET_FIELD(status);
-    GET_FIELD(date);
-    GET_FIELD(isbn_s);
-
-    #undef GET_FIELD
-
-    return output;
-}
-
-int alphabetic_priority_author(const void * _book_a, const void * _book_b) {
-    const Book * book_a = *((Book **) _book_a);
-    const Book * book_b = *((Book **) _book_b);
-    return alphabetic_priority_s(book_a->author, book_b->author);
-}
-
-int alphabetic_priority_title(const void * _book_a, const void * _book_b) {
-    const Book * book_a = *((Book **) _book_a);
-    const Book * book_b = *((Book **) _book_b);
-    return alphabetic_priority_s(book_a->title, book_b->title);
-}
-
-int alphabetic_priority_s(const char * _a, const char * _b) {
-    char * temp = sanitize_title(_a);    // have to malloc this and make a copy
-    char * a = malloc(strlen(temp) + 1); // because we are dealing with static buffers
-    memcpy(a, temp, strlen(temp) + 1);   // which are nice if you only call once
-    char * b = sanitize_title(_b);       // but not so much if you call twice
-
-    unsigned int smallest_strlen = (unsigned int) ((strlen(a) < strlen(b)) ? strlen(a) : strlen(b));
-
-    for(unsigned int i = 0; i < smallest_strlen; i++) {
-        int cmp = alphabetic_priority_c(a[i], b[i]);
-
-        if(cmp != 0) {
-            free(a);
-            return cmp;
-        }
-    }
-
-    free(a);
-    return 0;
-}
+// shelf orders
+// a ShelfOrder is compiled into one byte string per book (see build_sort_keys()), such that
+// memcmp() on two books' keys gives their order; sorting is then just a loop of byte compares
 
-// wrapper for the above so i can use it in qsort()
-int alphabetic_priority_qsort_s(const void * _a, const void * _b) {
-    const char * a = *(char **) _a;
-    const char * b = *(char **) _b;
-    return alphabetic_priority_s(a, b);
-}
+typedef struct {
+    struct {
+        BookField field;
+        bool descending;
+    } keys[EXPECTED_NUMBER_OF_FIELDS];
+    unsigned int num_keys;
 
-int alphabetic_priority_c(char a, char b) {
-    if(a < b) return -1;
-    if(a > b) return 1;
-    return 0; // a == b
-}
+    char error_detail[MAX_LINE_LENGTH]; // what didn't parse
+} ShelfOrder;
 
-// remove all spaces, remove "the," "on," "an," "a," turn all letters lowercase
-// this makes titles just slightly fuzzy which might be useful in future
-// "Being And Time" should equal "Being and Time" => "beingandtime"
-char * sanitize_title(const char * title) {
-    static char output_buf[256];
-    memset(output_buf, 0, 256);
-    unsigned int output_buf_idx = 0;
-
-    size_t beginning_offset = 0;
-    // i LOVE macros for eliminating redundant code
-    // this could NEVER go wrong <3
-    #define OFFSET(str) if(str_equal(title, str)) beginning_offset = strlen(str)
-    
-    OFFSET("The ");
-    OFFSET("An ");
-    OFFSET("On ");
-    OFFSET("A ");
-
-    #undef OFFSET
-
-    for(size_t i = beginning_offset; i < strlen(title); i++) {
-        char c = title[i];
-        if(c != ' ') { // exclude spaces
-            if((c >= 'A') && (c <= 'Z')) c += 'a' - 'A'; // decapitalize capitals
-
-            if((c >= 'a') && (c <= 'z')) { // only include alphabetical characters
-                // append to buf
-                output_buf[output_buf_idx] = c;
-                output_buf_idx++;
-            }
-        }
-    }
-
-    return output_buf;
-}
+extern const ShelfOrder DEFAULT_SHELF_ORDER; // author, then title
 
-// get rid of "" and newlines
-char * sanitize_data(char * value) {
-    static char output_buffer[256];
-    memset(output_buffer, 0, 256);
-    unsigned int output_buffer_idx = 0;
-
-    for(size_t i = 0; i < strlen(value); i++) {
-        char v = value[i];
-        if((v != '\"') && (v != '\n')) {
-            output_buffer[output_buffer_idx] = v;
-            output_buffer_idx++;
-        }
-    }
-
-    return output_buffer;
-}
+typedef struct {
+    unsigned char * blob;
+    size_t blob_size;
+    size_t blob_capacity;
+    unsigned int * offsets;             // by row
+    unsigned int * lengths;
+    unsigned long long * prefixes;      // the first 8 bytes of each key as a big endian number, so most compares skip memcmp()
+    const SorterAllocator * allocator;
+} SortKeys;
+
+SorterError parse_shelf_order(const char * spec, ShelfOrder * order); // "subject,author,-title"
+SorterError build_sort_keys(const Library * library, const ShelfOrder * order, SortKeys * keys);
+int compare_sort_keys(const void * _keys, unsigned int row_a, unsigned int row_b); // a row_comparator
+void destroy_sort_keys(SortKeys * keys);
+SorterError sort_library(Library * library, const ShelfOrder * order);
+// only sorts enough that order[begin .. end) is what sort_library() and then apply_collections() would put there;
+// the rest of the order is left in no particular order, so add the collections first and only look at the window
+// about O(n) rather than O(n log n), for showing one page of a big shelf
+SorterError sort_library_range(Library * library, const ShelfOrder * order, unsigned int begin, unsigned int end);
+bool order_keeps_authors_together(const ShelfOrder * order); // collections only make sense if it does
+unsigned int shelf_order_fields(const ShelfOrder * order); // the FIELD_BIT()s it sorts on
 
-// python: "if value in values"
-bool string_is_member(const char ** values, unsigned int num_values, const char * value) {
-    for(unsigned int i = 0; i < num_values; i++) {
-        if(str_equal(values[i], value)) return true;
-    }
-    return false;
-}
+//------------------------------------------------------------------------------
+// helpers, exposed because they're handy elsewhere
+// anything that produces a string writes into a buffer the caller passes in
+
+SorterError append_book(Library * library, const char * const * values, const unsigned int * lengths, unsigned int num_values);
+
+// row comparators, for sort_rows(); context is whatever the comparator needs, usually the Library
+typedef int (*row_comparator)(const void * context, unsigned int, unsigned int);
+void sort_rows(const SorterAllocator * allocator, const void * context, unsigned int * rows, unsigned int num_rows, row_comparator compare);
+void select_rows(const SorterAllocator * allocator, const void * context, unsigned int * rows, unsigned int num_rows, unsigned int k, row_comparator compare);
+int alphabetic_priority_author(const void * _library, unsigned int row_a, unsigned int row_b);
+int alphabetic_priority_title(const void * _library, unsigned int row_a, unsigned int row_b);
+int alphabetic_priority_shelf(const void * _library, unsigned int row_a, unsigned int row_b);
+int alphabetic_priority_qsort_s(const void * _a, const void * _b);
+int alphabetic_priority_s(const char * a, const char * b);
+char * sanitize_title(const char * title, char * output_buf, size_t output_buf_size);
+char * make_lowercase_string(const char * string, char * output_buf, size_t output_buf_size);
+bool string_is_member(const char ** values, unsigned int num_values, const char * value);
+int get_idx_by_value(const Library * library, const char * value, BookField field);
+bool str_equal(const char * str1, const char * str2); // boolean wrapper for strcmp()
+bool str_equal_nocase(const char * str1, const char * str2);
+int parse_date(const char * date);
+bool parse_field_name(const char * name, size_t len, BookField * field);
 
-// turns all capitals into lowercase
-// "Being And Time" -> "being and time"
-// this is NOT sanitize_title()
-char * make_lowercase_string(const char * string) {
-    static char output_buf[256];
-    memset(output_buf, 0, 256);
-    unsigned int output_buf_idx = 0;
+//------------------------------------------------------------------------------
+// queries (query.c)
+// build_index() once the library is sorted, then run as many queries against it as you like
+// the index is by shelf position, so rebuild it if the order changes
 
-    for(size_t i = 0; i < strlen(string); i++) {
-        char c = string[i];
-        if((c >= 'A') && (c <= 'Z')) c += 'a' - 'A';
+typedef enum {
+    MATCH_EQUAL,            // field=value      ignores case
+    MATCH_NOT_EQUAL,        // field!=value
+    MATCH_PREFIX,           // field^=value     ignores case
+    MATCH_LESS,             // field<value      by collation, or chronologically for dates
+    MATCH_LESS_EQUAL,       // field<=value
+    MATCH_GREATER,          // field>value
+    MATCH_GREATER_EQUAL     // field>=value
+} MatchOp;
 
-        // append to buf
-        output_buf[output_buf_idx] = c;
-        output_buf_idx++;
-    }
+typedef struct {
+    BookField field;
+    MatchOp op;
+    char value[MAX_LINE_LENGTH];
+} Predicate;
 
-    return output_buf;
-}
+typedef struct {
+    Predicate predicates[MAX_PREDICATES]; // all of these have to match
+    unsigned int num_predicates;
 
-// boolean wrapper for strcmp()
-bool str_equal(const char * str1, const char * str2) {
-    return (strcmp(str1, str2) == 0);
-}
+    char error_detail[MAX_LINE_LENGTH]; // what didn't parse
+} Query;
 
-//----------------------------
-// Library searcher implementations
+// one field's worth of index: every shelf position, grouped by dictionary code
+// values common enough that a bitmap is smaller than their list of positions also get a bitmap
+typedef struct {
+    unsigned int * value_starts;    // value v's positions are positions[value_starts[v] .. value_starts[v + 1])
+    unsigned int * positions;       // ascending within each value
+    unsigned long long ** dense;    // dense[v] is a bitmap of v's positions, or NULL
+    unsigned int num_values;
+} FieldIndex;
 
-int get_idx_by_title(Library * library, const char * title) {
-    char comp[strlen(title) + 1];
-    memset(comp, 0, strlen(title) + 1);
-    memcpy(comp, make_lowercase_string(title), strlen(title));
+typedef struct {
+    FieldIndex fields[EXPECTED_NUMBER_OF_FIELDS]; // only FIELD_IS_DICTIONARY fields are indexed
+    unsigned int * position_of;     // position_of[row], for scanning the plain columns
+    unsigned int num_books;
+    unsigned int num_words;         // length of a bitmap over every position
+    const SorterAllocator * allocator;
+} LibraryIndex;
 
-    for(unsigned int i = 0; i < library->num_books; i++) {
-        Book b = *(library->books[i]);
-        if(str_equal(comp, make_lowercase_string(b.title))) {
-            return i;
-        }
-    }
+// a query's matches, as shelf positions in shelf order
+typedef struct {
+    unsigned int * positions;
+    unsigned int num_positions;
+    const SorterAllocator * allocator;
+} Selection;
+
+SorterError parse_query(const char * expression, Query * query); // adds to whatever query already holds
+unsigned int query_fields(const Query * query); // the FIELD_BIT()s it looks at
+SorterError build_index(const Library * library, LibraryIndex * index);
+SorterError run_query(const Library * library, const LibraryIndex * index, const Query * query, Selection * selection);
+void destroy_index(LibraryIndex * index);
+void destroy_selection(Selection * selection);
 
-    return -1;
-}
+//------------------------------------------------------------------------------
+// reports (report.c)
+// counts of books per subject category, status and month acquired, in one pass over the library
 
-int get_idx_by_author(Library * library, const char * author) {
-    char comp[strlen(author) + 1];
-    memset(comp, 0, strlen(author) + 1);
-    memcpy(comp, make_lowercase_string(author), strlen(author));
+// the subject prefixes viewer.c colors by; a subject belongs to the first one it starts with
+#define NUM_SUBJECT_CATEGORIES 12
+extern const char * const SUBJECT_CATEGORIES[NUM_SUBJECT_CATEGORIES];
+int subject_category(const char * subject); // -1 if it's none of them
 
-    for(unsigned int i = 0; i < library->num_books; i++) {
-        Book b = *(library->books[i]);
-        if(str_equal(comp, make_lowercase_string(b.author))) {
-            return i;
-        }
-    }
+typedef struct {
+    int month;              // 202412, or 0 if the date couldn't be read
+    unsigned int count;
+} MonthCount;
 
-    return -1;
-}
+typedef struct {
+    unsigned int num_books;
+    unsigned int subject_counts[NUM_SUBJECT_CATEGORIES + 1];    // the last one is everything else
+    unsigned int * status_counts;   // by STATUS dictionary code
+    unsigned int num_statuses;
+    MonthCount * months;            // oldest first
+    unsigned int num_months;
+    const SorterAllocator * allocator;
+} Report;
+
+// the fields a report counts by; library_require_fields() them first
+#define REPORT_FIELDS (FIELD_BIT(SUBJECT) | FIELD_BIT(STATUS) | FIELD_BIT(DATE))
+
+// positions limits the report to those shelf positions (e.g. a query's matches); NULL means every book
+SorterError build_report(const Library * library, const unsigned int * positions, unsigned int num_positions, Report * report);
+void write_report(const Library * library, const Report * report, FILE * output_file, OutputFormat output_format);
+void destroy_report(Report * report);
 
-int get_idx_by_contributor(Library * library, const char * contributor) {
-    char comp[strlen(contributor) + 1];
-    memset(comp, 0, strlen(contributor) + 1);
-    memcpy(comp, make_lowercase_string(contributor), strlen(contributor));
+//------------------------------------------------------------------------------
+// input scanning (scan.c)
+// RFC 4180 style, for tab or comma delimited files: a field in double quotes can hold delimiters and
+// line breaks, with "" for a quote; Excel quotes exactly those fields when it exports
+// the quotes, delimiters and newlines are found 64 bytes at a time (with SSE2 where there is SSE2),
+// and a running xor over the quotes tells which of the others are inside a field
 
-    for(unsigned int i = 0; i < library->num_books; i++) {
-        Book b = *(library->books[i]);
-        if(str_equal(comp, make_lowercase_string(b.contributor))) {
-            return i;
-        }
-    }
+#define MAX_RECORD_FIELDS 64 // fields past this are dropped
 
-    return -1;
-}
+// values are unquoted and '\0' terminated, and only live until the handler returns
+// a line break inside a quoted field becomes a space, so a value never spans lines of output
+typedef struct {
+    const char * values[MAX_RECORD_FIELDS];
+    unsigned int lengths[MAX_RECORD_FIELDS];
+    unsigned int num_fields;    // a blank line is one empty field
+    unsigned int line;          // where the record starts, from 1
+} Record;
 
-int get_idx_by_subject(Library * library, const char * subject) {
-    char comp[strlen(subject) + 1];
-    memset(comp, 0, strlen(subject) + 1);
-    memcpy(comp, make_lowercase_string(subject), strlen(subject));
+// called once per record, in order; anything but SORTER_OK stops the scan and is returned from it
+typedef SorterError (*record_handler)(void * context, const Record * record);
 
-    for(unsigned int i = 0; i < library->num_books; i++) {
-        Book b = *(library->books[i]);
-        if(str_equal(comp, make_lowercase_string(b.subject))) {
-            return i;
-        }
-    }
+char detect_delimiter(const char * data, size_t size); // '\t' if the first line has a tab, ',' otherwise
+// field_mask (NULL for all) has bit i set for each field i to copy out; the others come back empty
+// it's read again for every field, so a handler can narrow it, e.g. once it has seen the header
+// SORTER_ERR_BAD_INPUT if the last quoted field never closes; bad_line (may be NULL) gets the line its record starts on
+SorterError scan_records(const SorterAllocator * allocator, const char * data, size_t size, char delimiter, const unsigned long long * field_mask, record_handler handle_record, void * context, unsigned int * bad_line);
 
-    return -1;
-}
+//------------------------------------------------------------------------------
+// fuzzy search (search.c)
+// titles and authors are broken into trigrams ("dawn" -> "  d", " da", "daw", "awn", "wn ") and indexed,
+// so a lookup only scores the books that share a trigram with the query instead of every row; the rest
+// cost one cleared counter each, and once per change of shelf order there's a pass to find where rows are now
+// similarity is the dice coefficient of the two trigram sets: 1 for the same words, 0 for nothing in common
+
+// results below this aren't worth showing
+#define SEARCH_MIN_SCORE 0.3f
+// a missing collection title is quietly replaced by its best match if it's at least this close
+#define SEARCH_ACCEPT_SCORE 0.75f
+#define MAX_SEARCH_RESULTS 32
+
+// one field's trigrams, as an inverted index: entry ids for each trigram bucket
+// entries are rows for TITLE and dictionary values for AUTHOR, so each author is only indexed once
+typedef struct {
+    unsigned int * bucket_starts;   // bucket b's entries are entries[bucket_starts[b] .. bucket_starts[b + 1])
+    unsigned int * entries;         // ascending within each bucket
+    unsigned short * num_grams;     // distinct trigrams per entry, for the score
+    unsigned int num_entries;
+} TrigramIndex;
+
+// by row rather than by shelf position, so it survives sorting; only position_of needs redoing
+typedef struct SearchIndex {
+    TrigramIndex titles;
+    TrigramIndex authors;
+    unsigned int * author_row_starts;   // author code a's rows are author_rows[author_row_starts[a] .. author_row_starts[a + 1])
+    unsigned int * author_rows;
+    unsigned int * position_of;         // position_of[row] = shelf position, as of shelf_version
+    unsigned int shelf_version;
+    const SorterAllocator * allocator;
+} SearchIndex;
 
-int get_idx_by_status(Library * library, const char * status) {
-    char comp[strlen(status) + 1];
-    memset(comp, 0, strlen(status) + 1);
-    memcpy(comp, make_lowercase_string(status), strlen(status));
+typedef struct {
+    unsigned int position;  // shelf position
+    float score;
+} SearchMatch;
 
-    for(unsigned int i = 0; i < library->num_books; i++) {
-        Book b = *(library->books[i]);
-        if(str_equal(comp, make_lowercase_string(b.status))) {
-            return i;
-        }
-    }
+// best first; ties go by shelf position
+typedef struct {
+    SearchMatch matches[MAX_SEARCH_RESULTS];
+    unsigned int num_matches;
+} SearchResults;
 
-    return -1;
-}
+SorterError build_search_index(const Library * library, SearchIndex * index);
+SorterError library_search_index(Library * library, const SearchIndex ** index); // builds library->search_index the first time, and catches it up with the shelf order
+// a book scores the better of its title and (if include_authors) its author
+SorterError search_library(const Library * library, const SearchIndex * index, const char * query, bool include_authors, SearchResults * results);
+void destroy_search_index(SearchIndex * index);
 
-int get_idx_by_date(Library * library, const char * date) {
-    char comp[strlen(date) + 1];
-    memset(comp, 0, strlen(date) + 1);
-    memcpy(comp, make_lowercase_string(date), strlen(date));
+//------------------------------------------------------------------------------
+// server (server.c)
+// keeps one sorted library in memory and answers requests about it on a unix socket, one line each
+// the input file is reloaded when it changes; the old library keeps answering until the new one is
+// completely ready, and stays if the new one doesn't load
 
-    for(unsigned int i = 0; i < library->num_books; i++) {
-        Book b = *(library->books[i]);
-        if(str_equal(comp, make_lowercase_string(b.date))) {
-            return i;
-        }
-    }
+// run on every (re)load after sorting, e.g. to add collections; only when the order keeps authors together
+typedef SorterError (*library_setup)(Library * library);
 
-    return -1;
-}
+typedef struct {
+    const char * input_filename;
+    const char * socket_path;
+    ShelfOrder order;
+    library_setup add_collections;  // NULL for none
+    volatile sig_atomic_t * stop;   // serve_library() returns once this is set, e.g. by a signal handler
+    const SorterAllocator * allocator; // NULL for malloc(); every loaded catalog comes from it
+} ServeOptions;
 
-int get_idx_by_isbn_s(Library * library, const char * isbn_s) {
-    char comp[strlen(isbn_s) + 1];
-    memset(comp, 0, strlen(isbn_s) + 1);
-    memcpy(comp, make_lowercase_string(isbn_s), strlen(isbn_s));
+SorterError serve_library(const ServeOptions * options);
 
-    for(unsigned int i = 0; i < library->num_books; i++) {
-        Book b = *(library->books[i]);
-        if(str_equal(comp, make_lowercase_string(b.isbn_s))) {
-            return i;
-        }
-    }
+//------------------------------------------------------------------------------
+// static site (site.c)
+// the shelf as a directory of OUTPUT_WEBSITE pages: one per letter of the author, or SITE_PAGE_SIZE
+// books each when the order doesn't keep authors together, plus index.html linking them
+// manifest.txt holds a hash of every page, and a page is only rewritten when its hash changes,
+// so adding a book touches that book's page and nothing else
 
-    return -1;
-}
+#define SITE_PAGE_SIZE 500
 
-//----------------------------
-// Book getter implementations
+typedef struct {
+    unsigned int num_pages;             // index included
+    unsigned int num_written;
+    unsigned int num_unchanged;
+    unsigned int num_removed;           // pages of the last run that aren't pages any more
+    char error_detail[3 * MAX_LINE_LENGTH]; // which file couldn't be written
+} SiteSummary;
 
-char * get_field_title(Book * book) {
-    return book->title;
-}
+// positions are shelf positions, e.g. a query's matches; NULL means every book (num_positions of them)
+SorterError write_site(const Library * library, const ShelfOrder * order, const unsigned int * positions, unsigned int num_positions, const char * output_dir, SiteSummary * summary);
 
-char * get_field_author(Book * book) {
-    return book->author;
-}
+//------------------------------------------------------------------------------
+// batches (batch.c)
+// the whole pipeline main() runs (parse, sort, collections, --where, output), for many catalogs at once
+// catalogs are handed out to a pool of worker threads, so one file's reading overlaps another's sorting
+// a catalog that fails doesn't stop the others, and its old output is left alone
 
-char * get_field_contributor(Book * book) {
-    return book->contributor;
-}
+#define MAX_BATCH_THREADS 8
 
-char * get_field_subject(Book * book) {
-    return book->subject;
-}
+typedef struct {
+    char * input_filename;
+    char * output_filename;
 
-char * get_field_status(Book * book) {
-    return book->status;
-}
+    SorterError error;
+    bool warning;                       // a collection couldn't be made as asked; the output was still written
+    char error_detail[2 * MAX_LINE_LENGTH]; // what went wrong, for errors and warnings
+    unsigned int num_books;
+    unsigned int num_written;           // after --where
+    double parse_seconds;
+    double sort_seconds;                // sorting, collections and --where
+    double output_seconds;
+} BatchJob;
 
-char * get_field_date(Book * book) {
-    return book->date;
-}
+typedef struct {
+    const char * path;                  // a directory of .txt/.csv catalogs, or a manifest of "input\toutput" lines
+    const char * output_dir;            // where a directory's outputs go; a manifest's relative outputs go here too if it's set
+    ShelfOrder order;
+    const Query * query;                // --where, or NULL for every book
+    library_setup add_collections;      // NULL for none; a missing title is only a warning here
+    unsigned int num_threads;           // 0 for one per CPU, up to MAX_BATCH_THREADS
+    const SorterAllocator * allocator;  // NULL for malloc(); every worker shares it, so it has to be thread safe
+} BatchOptions;
 
-char * get_field_isbn_s(Book * book) {
-    return book->isbn_s;
-}
+typedef struct {
+    BatchJob * jobs;                    // in manifest order, or by name for a directory
+    unsigned int num_jobs;
+    unsigned int num_failed;
+    unsigned int num_warnings;
+    unsigned int num_threads;
+    double wall_seconds;
+    char error_detail[MAX_LINE_LENGTH]; // why the catalogs couldn't be listed
+    const SorterAllocator * allocator;  // the jobs' filenames came from it
+} BatchSummary;
+
+// only fails if the catalogs can't be listed; how each catalog went is in the summary
+SorterError run_batch(const BatchOptions * options, BatchSummary * summary);
+void write_batch_summary(const BatchSummary * summary, FILE * output_file);
+void destroy_batch_summary(BatchSummary * summary);
+
+#endif
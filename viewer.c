@@ -49,21 +49,22 @@ const unsigned int COL_WIDTHS[EXPECTED_NUMBER_OF_FIELDS] = {
 };
 
 
-typedef Color (*ColumnColorizer)(char *, bool);
+typedef Color (*ColumnColorizer)(const char *, bool);
 
-Color colorize_titles(char * field, bool even);
-Color colorize_authors(char * field, bool even);
-Color colorize_contributors(char * field, bool even);
-Color colorize_subjects(char * field, bool even);
-Color colorize_statuses(char * field, bool even);
-Color colorize_dates(char * field, bool even);
-Color colorize_isbns(char * field, bool even);
+Color colorize_titles(const char * field, bool even);
+Color colorize_authors(const char * field, bool even);
+Color colorize_contributors(const char * field, bool even);
+Color colorize_subjects(const char * field, bool even);
+Color colorize_statuses(const char * field, bool even);
+Color colorize_dates(const char * field, bool even);
+Color colorize_isbns(const char * field, bool even);
 
 LIBRARY_FIELD_MAPPING(COL_COLORS, ColumnColorizer, colorize_titles, colorize_authors, colorize_contributors, colorize_subjects, colorize_statuses, colorize_dates, colorize_isbns);
 LIBRARY_FIELD_MAPPING(COL_TITLES, char *, "Title", "Author(s)", "Contributor(s)", "Subject", "Status", "Date Acquired", "ISBN");
 
 void draw_column_headers(const unsigned int column_widths[], const char * column_titles[]);
-void draw_column_values(const unsigned int column_widths[], Library * library, unsigned int starting_at);
+void draw_column_values(const unsigned int column_widths[], Library * library, const Selection * selection, unsigned int starting_at);
+void draw_filter_panel(const char * filter_text, bool editing, const char * filter_message);
 void draw_help_message();
 
 //--- MAIN --------------------------------------------------------------------
@@ -76,39 +77,128 @@ int main(int argc, char ** argv) {
 
     //--- PROGRAM INIT -------------------------------------------------------------
 
-    struct parse_args_ret_t args = parse_args(argc, argv);
-    struct open_files_ret_t files = open_files(args);
+    SorterArgs args;
+    SorterFiles files;
+    Library library;
+    SorterError error;
+
+    if((error = parse_args(argc, argv, &args)) != SORTER_OK
+        || (error = open_files(&args, &files)) != SORTER_OK) {
+        CloseWindow();
+        if(error == SORTER_ERR_USAGE) printf(USAGE_MESSAGE);
+        else printf("ERROR: %s!\n", sorter_strerror(error));
+        return 1;
+    }
     if(files.output_file != NULL) fclose(files.output_file); // we don't need this
     
-    Library library = parse_library(files.input_file);
+    if((error = parse_library(files.input_file, NULL, &library)) != SORTER_OK) {
+        CloseWindow();
+        printf("ERROR: %s!\n %s!\n", sorter_strerror(error), library.error_detail);
+        return 2;
+    }
 
     //----------------------------
 
-    sort_by_author(&library);
-    add_collection(&library, 4, "Spring Snow", "Runaway Horses", "The Temple of Dawn", "The Decay of the Angel");
-    apply_collections(&library);
+    ShelfOrder order = DEFAULT_SHELF_ORDER;
+    if(args.order != NULL && (error = parse_shelf_order(args.order, &order)) != SORTER_OK) {
+        printf("WARNING: %s! %s; using the default\n", sorter_strerror(error), order.error_detail);
+        order = DEFAULT_SHELF_ORDER;
+    }
+
+    if((error = sort_library(&library, &order)) != SORTER_OK) {
+        CloseWindow();
+        printf("ERROR: %s!\n", sorter_strerror(error));
+        return 3;
+    }
+    if(order_keeps_authors_together(&order)) {
+        if((error = add_collection(&library, 4, "Spring Snow", "Runaway Horses", "The Temple of Dawn", "The Decay of the Angel")) != SORTER_OK) {
+            printf("WARNING: %s! %s\n", sorter_strerror(error), library.error_detail);
+        }
+        apply_collections(&library);
+    }
+
+    LibraryIndex index;
+    if((error = build_index(&library, &index)) != SORTER_OK) {
+        CloseWindow();
+        printf("ERROR: %s!\n", sorter_strerror(error));
+        return 3;
+    }
 
     unsigned int starting_at = 0;
 
     bool show_help = false;
 
+    // filter panel; while it's open, typing goes into filter_text instead of scrolling
+    bool filter_open = false;
+    char filter_text[MAX_LINE_LENGTH] = { 0 };
+    unsigned int filter_len = 0;
+    char filter_message[MAX_LINE_LENGTH] = { 0 };
+    bool filtered = false;
+    Selection selection = { 0 };
+
     //--- DRAWING ------------------------------------------------------------------
 
     while(!WindowShouldClose()) {
         //---- UPDATE ------------------------------------------------------------------
 
-        if(IsKeyPressedRepeat(KEY_DOWN) || IsKeyPressedRepeat(KEY_SPACE)
-            || IsKeyPressed(KEY_DOWN) || IsKeyPressed(KEY_SPACE)) {
-            if(starting_at < (library.num_books - NUM_ROWS_AT_ONCE)) starting_at++;
-        }
+        unsigned int num_rows = filtered ? selection.num_positions : library.num_books;
 
-        if(IsKeyPressedRepeat(KEY_UP) || IsKeyPressedRepeat(KEY_BACKSPACE)
-            || IsKeyPressed(KEY_UP) || IsKeyPressed(KEY_BACKSPACE)) {
-            if(starting_at > 0) starting_at--;
-        }
+        if(filter_open) {
+            int c;
+            while((c = GetCharPressed()) != 0) {
+                if(c >= 32 && c < 127 && filter_len + 1 < sizeof(filter_text)) {
+                    filter_text[filter_len++] = (char) c;
+                    filter_text[filter_len] = '\0';
+                }
+            }
+
+            if((IsKeyPressed(KEY_BACKSPACE) || IsKeyPressedRepeat(KEY_BACKSPACE)) && filter_len > 0) {
+                filter_text[--filter_len] = '\0';
+            }
+
+            if(IsKeyPressed(KEY_ENTER)) {
+                filter_open = false;
+                filter_message[0] = '\0';
+
+                if(filter_len == 0) { // an empty filter shows everything again
+                    destroy_selection(&selection);
+                    filtered = false;
+                } else {
+                    Query query = { 0 };
+                    Selection matches;
+                    if((error = parse_query(filter_text, &query)) != SORTER_OK) {
+                        snprintf(filter_message, sizeof(filter_message), "%s", query.error_detail);
+                        filter_open = true; // leave it open so it can be fixed
+                    } else if((error = run_query(&library, &index, &query, &matches)) != SORTER_OK) {
+                        snprintf(filter_message, sizeof(filter_message), "%s", sorter_strerror(error));
+                    } else {
+                        destroy_selection(&selection);
+                        selection = matches;
+                        filtered = true;
+                        snprintf(filter_message, sizeof(filter_message), "%u of %u books", selection.num_positions, library.num_books);
+                    }
+                }
+                starting_at = 0;
+            }
+        } else {
+            if(IsKeyPressedRepeat(KEY_DOWN) || IsKeyPressedRepeat(KEY_SPACE)
+                || IsKeyPressed(KEY_DOWN) || IsKeyPressed(KEY_SPACE)) {
+                if(starting_at + NUM_ROWS_AT_ONCE < num_rows) starting_at++;
+            }
+
+            if(IsKeyPressedRepeat(KEY_UP) || IsKeyPressedRepeat(KEY_BACKSPACE)
+                || IsKeyPressed(KEY_UP) || IsKeyPressed(KEY_BACKSPACE)) {
+                if(starting_at > 0) starting_at--;
+            }
 
-        if(IsKeyPressed(KEY_SLASH) && IsKeyDown(KEY_LEFT_SHIFT)) {
-            show_help = !show_help;
+            if(IsKeyPressed(KEY_SLASH) && IsKeyDown(KEY_LEFT_SHIFT)) {
+                show_help = !show_help;
+            }
+
+            if(IsKeyPressed(KEY_F)) {
+                filter_open = true;
+                while(GetCharPressed() != 0) { } // don't let the F itself land in the box
+            }
         }
 
         //---- DRAW --------------------------------------------------------------------
@@ -118,8 +208,9 @@ int main(int argc, char ** argv) {
             ClearBackground(BLACK);
 
             draw_column_headers(COL_WIDTHS, COL_TITLES);
-            draw_column_values(COL_WIDTHS, &library, starting_at);
+            draw_column_values(COL_WIDTHS, &library, filtered ? &selection : NULL, starting_at);
 
+            if(filter_open || filtered) draw_filter_panel(filter_text, filter_open, filter_message);
             if(show_help) draw_help_message();
             
         EndDrawing();
@@ -130,7 +221,9 @@ int main(int argc, char ** argv) {
     //---- DE-INIT -----------------------------------------------------------------
 
     CloseWindow();
-    destroy_library(library);
+    destroy_selection(&selection);
+    destroy_index(&index);
+    destroy_library(&library);
 
     return 0;
 }
@@ -151,19 +244,21 @@ void draw_column_headers(const unsigned int column_widths[], const char * column
     }
 }
 
-void draw_column_values(const unsigned int column_widths[], Library * library, unsigned int starting_at) {
+// selection is NULL when there's no filter
+void draw_column_values(const unsigned int column_widths[], Library * library, const Selection * selection, unsigned int starting_at) {
     int y_offset = 0;
     int x_offset = 0;
-    int last_row_rendered = (starting_at + NUM_ROWS_AT_ONCE);
+    unsigned int num_rows = (selection != NULL) ? selection->num_positions : library->num_books;
+    unsigned int last_row_rendered = (starting_at + NUM_ROWS_AT_ONCE);
+    if(last_row_rendered > num_rows) last_row_rendered = num_rows;
     
-    for(int i = starting_at; i < last_row_rendered; i++) {
+    for(unsigned int i = starting_at; i < last_row_rendered; i++) {
         y_offset += ROW_HEIGHT - ROW_BORDER;
-        Book * book = library->books[i];
         
         for(int j = 0; j < EXPECTED_NUMBER_OF_FIELDS; j++) {
             int width = column_widths[j];
             if(width != 0) {
-                char * value = get_field[j](book);
+                const char * value = get_field[j](library, (selection != NULL) ? selection->positions[i] : i);
                 Color background_color = COL_COLORS[j](value, (i % 2) == 0);
                 DrawRectangleRec((Rectangle) { x_offset, y_offset, width + ROW_BORDER, ROW_HEIGHT }, background_color);
                 DrawText(value, x_offset + TEXT_X_OFFSET, y_offset + TEXT_Y_OFFSET, FONT_SIZE, VALUE_COLOR);
@@ -176,9 +271,25 @@ void draw_column_values(const unsigned int column_widths[], Library * library, u
     }
 }
 
+void draw_filter_panel(const char * filter_text, bool editing, const char * filter_message) {
+    int p_height = ROW_HEIGHT + ROW_BORDER;
+    int y_offset = HEIGHT - p_height;
+
+    DrawRectangle(0, y_offset, WIDTH, p_height, Fade(GetColor(0xddddddff), 0.9f));
+    DrawRectangleLinesEx((Rectangle) { 0, y_offset, WIDTH, p_height }, ROW_BORDER, BORDER_COLOR);
+
+    const char * text = TextFormat("Filter: %s%s", filter_text, editing ? "_" : "");
+    DrawText(text, TEXT_X_OFFSET, y_offset + TEXT_Y_OFFSET, FONT_SIZE, BLACK);
+
+    if(filter_message[0] != '\0') {
+        int message_width = MeasureText(filter_message, FONT_SIZE);
+        DrawText(filter_message, WIDTH - message_width - TEXT_X_OFFSET, y_offset + TEXT_Y_OFFSET, FONT_SIZE, DARKGRAY);
+    }
+}
+
 void draw_help_message() {
     int m_width = 1100;
-    int m_height = 290;
+    int m_height = 340;
     
     int x_offset = (WIDTH - m_width) / 2;
     int y_offset = (HEIGHT - m_height) / 2;
@@ -190,7 +301,8 @@ void draw_help_message() {
     DrawText("Press SPACE or DOWN to scroll down.", x_offset + 10, y_offset + 10 + 80, 40, BLACK);
     DrawText("Press BACKSPACE or UP to scroll up.", x_offset + 10, y_offset + 10 + 80 + 50, 40, BLACK);
     DrawText("Press ? (SHIFT + /) to show/close this message.", x_offset + 10, y_offset + 10 + 80 + 50 + 50, 40, BLACK);
-    DrawText("Press ESC to exit this program.", x_offset + 10, y_offset + 10 +80 + 50 + 50 + 50, 40, BLACK);
+    DrawText("Press F to filter, e.g. status=None && date>=2024.", x_offset + 10, y_offset + 10 + 80 + 50 + 50 + 50, 40, BLACK);
+    DrawText("Press ESC to exit this program.", x_offset + 10, y_offset + 10 +80 + 50 + 50 + 50 + 50, 40, BLACK);
 }
 
 #define DEFAULT_BACKGROUND_COLOR (Color) { 0xaa, 0xaa, 0xaa, 0xff }
@@ -200,48 +312,46 @@ static inline Color darken_color(Color color) {
     return (Color) { color.r - DARKENING_AMOUNT, color.g - DARKENING_AMOUNT, color.b - DARKENING_AMOUNT, color.a - DARKENING_AMOUNT };
 }
 
-Color colorize_titles(char * field, bool even) {
+Color colorize_titles(const char * field, bool even) {
     return (even) ? DEFAULT_BACKGROUND_COLOR : darken_color(DEFAULT_BACKGROUND_COLOR);
 }
 
-Color colorize_authors(char * field, bool even) {
+Color colorize_authors(const char * field, bool even) {
     return (even) ? DEFAULT_BACKGROUND_COLOR : darken_color(DEFAULT_BACKGROUND_COLOR);
 }
 
-Color colorize_contributors(char * field, bool even) {
+Color colorize_contributors(const char * field, bool even) {
     return (even) ? DEFAULT_BACKGROUND_COLOR : darken_color(DEFAULT_BACKGROUND_COLOR);
 }
 
-Color colorize_subjects(char * field, bool even) {
-    Color c = DEFAULT_BACKGROUND_COLOR;
+Color colorize_subjects(const char * field, bool even) {
+    // one per SUBJECT_CATEGORIES entry (see report.c), in the same order
+    static const unsigned int CATEGORY_COLORS[NUM_SUBJECT_CATEGORIES] = {
+        0xdcf3d3ff, // History
+        0xb9e7a7ff, // Biography
+        0xb9e7a7ff, // Sociology
+        0xb9e7a7ff, // Psychology
 
-    // checks front
-    
-    #define str_case(string_value, color_hex) else if(strncmp(string_value, field, strlen(string_value)) == 0) { c = GetColor(color_hex); }
-    
-    if(strncmp("History", field, strlen("History")) == 0) { c = GetColor(0xdcf3d3ff); }
-    str_case("Biography", 0xb9e7a7ff)
-    str_case("Sociology", 0xb9e7a7ff)
-    str_case("Psychology", 0xb9e7a7ff)
+        0xdbdbdbff, // Score
+        0xdbdbdbff, // Technical
 
-    str_case("Score", 0xdbdbdbff)
-    str_case("Technical", 0xdbdbdbff)
-    
-    str_case("Literature", 0xfbe4d7ff)
-    str_case("Criticism", 0xf7cab0ff)
-    
-    str_case("Religion", 0xf3d1f0ff)
-    str_case("Textbook; Religion", 0xf3d1f0ff)
-    str_case("Religious Primary", 0xe5a3dfff)
-    
-    str_case("Philosophy", 0xcdeefbff)
+        0xfbe4d7ff, // Literature
+        0xf7cab0ff, // Criticism
 
-    #undef str_case
+        0xf3d1f0ff, // Religion
+        0xf3d1f0ff, // Textbook; Religion
+        0xe5a3dfff, // Religious Primary
 
-    return c;
+        0xcdeefbff, // Philosophy
+    };
+
+    // checks front
+    int category = subject_category(field);
+    if(category < 0) return DEFAULT_BACKGROUND_COLOR;
+    return GetColor(CATEGORY_COLORS[category]);
 }
 
-Color colorize_statuses(char * field, bool even) {
+Color colorize_statuses(const char * field, bool even) {
     Color c = DEFAULT_BACKGROUND_COLOR;
 
     #define str_case(string_value, color_hex) else if(strncmp(string_value, field, strlen(string_value)) == 0) { c = GetColor(color_hex); }
@@ -253,10 +363,10 @@ Color colorize_statuses(char * field, bool even) {
     return c;
 }
 
-Color colorize_dates(char * field, bool even) {
+Color colorize_dates(const char * field, bool even) {
     return (even) ? DEFAULT_BACKGROUND_COLOR : darken_color(DEFAULT_BACKGROUND_COLOR);
 }
 
-Color colorize_isbns(char * field, bool even) {
+Color colorize_isbns(const char * field, bool even) {
     return (even) ? DEFAULT_BACKGROUND_COLOR : darken_color(DEFAULT_BACKGROUND_COLOR);
 }
\ No newline at end of file